@@ -1,8 +1,13 @@
 #ifndef OFFLINE_CAMERA_H
 #define OFFLINE_CAMERA_H
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <opencv2/core/core.hpp>
@@ -10,6 +15,8 @@
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include "util/camera_util.h"
+#include "util/packed_dataset.h"
+#include "util/profile_util.h"
 
 class CameraStream
 {
@@ -19,7 +26,7 @@ protected:
 
 public:
     CameraStream();
-    ~CameraStream();
+    virtual ~CameraStream();
 
     // The camera stream is expected to return
     // the RGB image, depth image, and timestamp
@@ -32,19 +39,74 @@ public:
     int get_frame_count() const;
 };
 
+// Decoder statistics, used to size the read-ahead pool.
+struct DecoderStats
+{
+    int frames_returned;
+    int frames_starved;
+    double starved_ms;
+};
+
 class OfflineCameraStream : public CameraStream
 {
 private:
+    // A decoded frame waiting to be returned by get_stream()
+    struct DecodedFrame
+    {
+        cv::Mat rgb;
+        cv::Mat depth;
+        bool ready;
+    };
+
     std::string m_dataset_dir;
     std::vector<std::string> m_rgb_images;
     std::vector<std::string> m_depth_images;
     std::vector<double> m_timestamps;
     int m_index;
 
+    // Read-ahead queue: frame i is decoded into slot (i % m_read_ahead)
+    // by one of the decoder threads while earlier frames are being tracked.
+    int m_read_ahead;
+    int m_next_decode;
+    std::vector<DecodedFrame> m_slots;
+    std::vector<std::thread> m_decoders;
+    std::mutex m_decode_mutex;
+    std::condition_variable m_slot_freed;
+    std::condition_variable m_slot_ready;
+    bool m_stop_decoding;
+
+    // The main loop is starved whenever the frame it asks for isn't decoded yet
+    DecoderStats m_stats;
+
 public:
-    OfflineCameraStream(const std::string& dataset_dir, OfflineDatasetType type);
+    // With 0 decoder threads, frames are decoded synchronously in get_stream().
+    OfflineCameraStream(const std::string& dataset_dir, OfflineDatasetType type,
+                        int num_decoder_threads = 0, int read_ahead = 4);
+    virtual ~OfflineCameraStream();
 
     virtual std::tuple<cv::Mat, cv::Mat, double> get_stream();
+
+    DecoderStats get_decoder_stats();
+
+private:
+    void decode_frame(int index, cv::Mat &rgb, cv::Mat &depth) const;
+    void run_decoder();
+};
+
+// This implementation reads frames from a memory-mapped packed dataset,
+// so no frames have to be decoded or copied.
+class PackedCameraStream : public CameraStream
+{
+private:
+    PackedDataset m_dataset;
+    int m_index;
+
+public:
+    PackedCameraStream(const std::string &packed_path);
+
+    virtual std::tuple<cv::Mat, cv::Mat, double> get_stream();
+
+    const PackedDataset& get_dataset() const;
 };
 
-#endif // CAMERA_STREAM_H
\ No newline at end of file
+#endif // CAMERA_STREAM_H
@@ -3,16 +3,22 @@
 
 #include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 #include <cstdlib>
 #include <regex>
 #include <vector>
 
+#include <Eigen/Core>
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 
 #include "util/camera_util.h"
+#include "util/depth_util.h"
+#include "util/matrix_util.h"
 
 // Base class defines an interface for depth completion
 class DepthCompleter
@@ -24,8 +30,23 @@ public:
     DepthCompleter();
     virtual ~DepthCompleter();
 
-    virtual void complete_depth_image(const cv::Mat &incomplete_depth_image) = 0;
+    // Both images are expected to have the same resolution. The RGB image
+    // can be used as guidance, and may be ignored by some implementations.
+    virtual void complete_depth_image(const cv::Mat &rgb_image, const cv::Mat &incomplete_depth_image) = 0;
     const cv::Mat& get_depth_image() const;
+
+    // Called before each frame with the camera pose from tracking (world to camera),
+    // and whether tracking succeeded. Most implementations ignore it.
+    virtual void set_camera_pose(const Eigen::Matrix4f &camera_pose, bool tracking_ok);
+
+    // Called before each frame with its index in the camera stream, which
+    // keeps track of the frames dropped before completion. Most implementations ignore it.
+    virtual void set_frame_index(int index);
+
+    // Thread-safe implementations can run on any thread, alongside light estimation.
+    // Stateful implementations depend on previous frames, so they have to see every frame in order.
+    virtual bool is_thread_safe() const;
+    virtual bool is_stateful() const;
 };
 
 // This implementation looks up pre-computed completed depths.
@@ -40,7 +61,128 @@ private:
 public:
     OfflineDepthCompleter(const std::string &dataset_dir, const std::string &prefix, OfflineDatasetType type);
 
-    virtual void complete_depth_image(const cv::Mat &incomplete_depth_image);
+    virtual void complete_depth_image(const cv::Mat &rgb_image, const cv::Mat &incomplete_depth_image);
+
+    // Depth images are looked up by frame index. Without one, each call reads the next image.
+    virtual void set_frame_index(int index);
+
+    virtual bool is_thread_safe() const;
+    virtual bool is_stateful() const;
+};
+
+// This implementation fills holes in the raw sensor depth with a sequence of
+// morphological operations (IP-Basic). The image is split into row bands
+// that are processed in parallel, each with enough overlap that the result
+// is the same as processing the whole image at once.
+class MorphologicalDepthCompleter : public DepthCompleter
+{
+private:
+    float m_scale;
+    int m_num_bands;
+
+    // Each band has its own scratch buffers, so no band allocates after the first frame
+    std::vector<cv::Mat> m_band_depths;
+    std::vector<cv::Mat> m_band_buffers;
+
+    cv::Mat m_diamond_kernel_5;
+    cv::Mat m_full_kernel_5;
+    cv::Mat m_full_kernel_7;
+    cv::Mat m_full_kernel_31;
+
+public:
+    // With 0 bands, the image is split into one band per OpenCV thread
+    MorphologicalDepthCompleter(OfflineDatasetType type, int num_bands = 0);
+
+    virtual void complete_depth_image(const cv::Mat &rgb_image, const cv::Mat &incomplete_depth_image);
+
+    virtual bool is_thread_safe() const;
+    virtual bool is_stateful() const;
+
+private:
+    void complete_band(const cv::Mat &incomplete_depth_image, int band, int row_start, int row_end);
+};
+
+// This implementation fills holes with a joint bilateral filter guided by the RGB image,
+// so that completed depth edges line up with color edges. The filter is approximated
+// with the domain transform (Gastal and Oliveira 2011), whose cost is linear in the
+// number of pixels regardless of the filter size. Sparse depth is filtered with
+// normalized convolution, and measured depths are kept as they are.
+class GuidedDepthCompleter : public DepthCompleter
+{
+private:
+    float m_scale;
+    float m_sigma_spatial;
+    float m_sigma_range;
+    int m_num_iterations;
+
+    // Domain transform derivatives along rows and columns
+    cv::Mat m_horizontal_derivative, m_vertical_derivative;
+
+    // Per-iteration filter weights, and the two channels being filtered
+    cv::Mat m_horizontal_weights, m_vertical_weights;
+    cv::Mat m_weighted_depth, m_confidence;
+
+public:
+    GuidedDepthCompleter(OfflineDatasetType type, float sigma_spatial = 30.0f, float sigma_range = 0.08f, int num_iterations = 3);
+
+    virtual void complete_depth_image(const cv::Mat &rgb_image, const cv::Mat &incomplete_depth_image);
+
+    virtual bool is_thread_safe() const;
+    virtual bool is_stateful() const;
+
+private:
+    void compute_derivatives(const cv::Mat &rgb_image);
+    void filter_horizontal(const cv::Mat &weights);
+    void filter_vertical(const cv::Mat &weights);
+};
+
+// This implementation reuses the previous completed depth, reprojected into the current
+// frame with the camera pose from tracking. Only holes in the raw depth that nothing was
+// reprojected onto (disocclusions), or that lie in tiles where the reprojection disagrees
+// with the raw depth, are completed again by the wrapped implementation. Everything is
+// recomputed when tracking is lost, and periodically so that errors don't accumulate.
+class TemporalDepthCompleter : public DepthCompleter
+{
+private:
+    DepthCompleter &m_completer;
+    float m_scale;
+    float m_fx, m_fy, m_cx, m_cy;
+    int m_refresh_interval;
+
+    // Poses of the current frame and of the previous completed depth
+    Eigen::Matrix4f m_camera_pose, m_previous_pose;
+    bool m_tracking_ok, m_has_previous_pose;
+    int m_frames_since_refresh;
+
+    // The previous depth warped into the current frame (0 where nothing landed),
+    // and the raw depth with the reused depths filled in, which the wrapped
+    // implementation completes around the pixels that have to be recomputed.
+    cv::Mat m_previous_depth;
+    cv::Mat m_reprojected;
+    cv::Mat m_fused_depth;
+    cv::Mat m_recompute;
+    std::vector<uchar> m_dirty_tiles;
+
+    double m_recomputed_sum;
+    int m_frame_count;
+
+public:
+    TemporalDepthCompleter(DepthCompleter &completer, OfflineDatasetType type, const std::string &camera_settings, int refresh_interval = 30);
+    virtual ~TemporalDepthCompleter();
+
+    virtual void complete_depth_image(const cv::Mat &rgb_image, const cv::Mat &incomplete_depth_image);
+    virtual void set_camera_pose(const Eigen::Matrix4f &camera_pose, bool tracking_ok);
+    virtual void set_frame_index(int index);
+
+    virtual bool is_thread_safe() const;
+    virtual bool is_stateful() const;
+
+    // Average fraction of pixels that were completed again
+    double get_recomputed_fraction() const;
+
+private:
+    void complete_all(const cv::Mat &rgb_image, const cv::Mat &incomplete_depth_image);
+    void reproject();
 };
 
 #endif // DEPTH_COMPLETION_H
\ No newline at end of file
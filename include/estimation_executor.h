@@ -0,0 +1,39 @@
+#ifndef ESTIMATION_EXECUTOR_H
+#define ESTIMATION_EXECUTOR_H
+
+#include <future>
+#include <vector>
+
+#include <Eigen/Core>
+#include <opencv2/core/core.hpp>
+
+#include "util/profile_util.h"
+#include "util/thread_pool.h"
+#include "depth_completion.h"
+#include "light_estimation.h"
+
+// The EstimationExecutor runs light estimation and depth completion for a frame
+// at the same time on a shared thread pool, and waits for both before returning.
+// Implementations that aren't thread-safe always run on the calling thread.
+class EstimationExecutor
+{
+private:
+    ThreadPool &m_pool;
+    LightEstimator &m_light_estimator;
+    DepthCompleter &m_depth_completer;
+
+public:
+    EstimationExecutor(ThreadPool &pool, LightEstimator &light_estimator, DepthCompleter &depth_completer);
+
+    void set_camera_pose(const Eigen::Matrix4f &camera_pose, bool tracking_ok);
+    void set_frame_index(int index);
+    void run(const cv::Mat &rgb_image, const cv::Mat &depth_image);
+
+    const std::vector<Light>& get_lights() const;
+    const cv::Mat& get_depth_image() const;
+
+    // If either implementation is stateful, frames can't be dropped before they're estimated
+    bool is_stateful() const;
+};
+
+#endif // ESTIMATION_EXECUTOR_H
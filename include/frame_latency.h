@@ -0,0 +1,91 @@
+#ifndef FRAME_LATENCY_H
+#define FRAME_LATENCY_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <imgui.h>
+
+#include "frame_pool.h"
+
+// Time on the steady clock, used to stamp frames as they move through the pipeline
+inline int64_t latency_clock_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// When each stage finished with a presented frame, in milliseconds after it was captured
+struct FrameLatency
+{
+    int index;
+    double capture_ms;      // Since the first presented frame was captured
+    double tracked_ms;
+    double completed_ms;
+    double submitted_ms;
+    double presented_ms;    // End-to-end (motion-to-photon) latency
+    double pose_age_ms;     // How old the camera pose was when presented
+    double depth_age_ms;    // How old the completed depth was when presented
+    int dropped;            // Frames that never made it to the screen since the previous one
+    int duplicates;         // Times the previous frame was presented again before this one
+};
+
+// The LatencyMonitor keeps track of how stale the presented frames are. It's only
+// used by the render thread, which draws recent latencies in the UI. Its memory
+// doesn't grow with the length of the run: the UI only keeps the most recent frames,
+// and every frame is written to the CSV file (if there is one) as it's presented.
+class LatencyMonitor
+{
+private:
+    // Histograms cover the most recent frames, in 5 ms bins up to 200 ms
+    static const int HISTORY_SIZE = 256;
+    static const int NUM_BINS = 40;
+    static constexpr float BIN_MS = 5.0f;
+
+    // The end-to-end latency of the whole run is summarized from 0.1 ms bins up to 1 s
+    static const int NUM_SUMMARY_BINS = 10000;
+    static constexpr double SUMMARY_BIN_MS = 0.1;
+
+    // Ring of the most recent frames, where m_presented is the total number of frames
+    std::vector<FrameLatency> m_history;
+    size_t m_presented;
+    std::vector<long> m_summary_bins;
+
+    std::ofstream m_csv;
+    std::string m_csv_path;
+
+    int64_t m_first_capture_ns;
+    int m_last_index;
+    int m_pending_duplicates;
+    long m_total_dropped;
+    long m_total_duplicates;
+
+public:
+    LatencyMonitor();
+
+    // Called right after presenting a frame. When no new frame arrived in time,
+    // the previous one is presented again, which counts as a duplicate.
+    void record_present(const Frame &frame, bool new_frame, int64_t present_ns);
+
+    // Histograms of end-to-end latency, pose age and depth age, along with
+    // dropped and duplicated frame counts. Has to be called inside an ImGui window.
+    void draw_ui() const;
+
+    // Every frame presented from now on is written to the given file, until it's closed
+    bool open_csv(const std::string &filepath);
+    void close_csv();
+
+    void print_summary() const;
+
+private:
+    void draw_histogram(const char* label, double FrameLatency::*metric) const;
+    double percentile(double FrameLatency::*metric, double p) const;
+    double summary_percentile(double p) const;
+};
+
+#endif // FRAME_LATENCY_H
@@ -0,0 +1,118 @@
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <System.h> // ORB-SLAM system needed for tracking
+
+#include "util/bounded_queue.h"
+#include "util/profile_util.h"
+#include "camera_stream.h"
+#include "estimation_executor.h"
+#include "frame_pool.h"
+#include "recording_sink.h"
+#include "slam_trace.h"
+#include "renderer.h"
+
+struct PipelineSettings
+{
+    int width, height;
+
+    // The camera produces a frame every period, regardless of how long the frames take
+    std::chrono::microseconds frame_period;
+
+    // How many frames can wait between two stages, and what happens when there's no room
+    int queue_capacity;
+    DropPolicy drop_policy;
+
+    // Headless runs aren't paced (the frame period is ignored), and the renderer
+    // sends every frame it renders to the recording sink itself, so there's no record stage.
+    bool headless;
+};
+
+struct StageStats
+{
+    int frames;
+    double busy_ms;
+};
+
+// The FramePipeline runs every per-frame step on its own thread, connected by bounded queues:
+// I/O -> tracking -> light estimation and depth completion -> render submit -> record.
+// The record stage only reads rendered frames back, and leaves the encoding to the RecordingSink.
+// Throughput is limited by the slowest stage instead of the sum of all stages.
+class FramePipeline
+{
+private:
+    PipelineSettings m_settings;
+
+    CameraStream &m_camera;
+    ORB_SLAM3::System* m_slam;
+    EstimationExecutor &m_estimation;
+    Renderer &m_renderer;
+    FramePool &m_frame_pool;
+
+    // Queues between each of the stages
+    BoundedQueue<Frame*> m_tracking_queue;
+    BoundedQueue<Frame*> m_estimation_queue;
+    BoundedQueue<Frame*> m_submit_queue;
+    BoundedQueue<int> m_record_queue;
+
+    // Called on the submit stage right before a frame is handed to the renderer
+    std::function<void(int)> m_on_submit;
+
+    // Rendered frames are handed to the sink when it's set
+    RecordingSink* m_recording;
+
+    // Tracking results are either recorded to a trace, or replayed from one instead of running SLAM
+    SlamTraceWriter* m_trace_writer;
+    SlamTraceReader* m_trace_reader;
+
+    std::vector<std::thread> m_threads;
+    StageStats m_io_stats, m_tracking_stats, m_estimation_stats, m_submit_stats, m_record_stats;
+    int m_late_frames;
+
+public:
+    FramePipeline(const PipelineSettings &settings,
+                  CameraStream &camera,
+                  ORB_SLAM3::System* slam,
+                  EstimationExecutor &estimation,
+                  Renderer &renderer,
+                  FramePool &frame_pool);
+
+    void set_submit_callback(const std::function<void(int)> &on_submit);
+    void set_recording_sink(RecordingSink* recording);
+    void set_trace_writer(SlamTraceWriter* trace_writer);
+    void set_trace_reader(SlamTraceReader* trace_reader);
+
+    // Starts every stage and waits until the whole camera stream has been processed
+    void run();
+
+private:
+    // Each stage runs on its own thread
+    void run_io();
+    void run_tracking();
+    void run_estimation();
+    void run_submit();
+    void run_record();
+
+    // Copies the tracking results out of SLAM into the frame
+    void track(Frame &frame);
+
+    // Sends a frame to the next stage, recycling whatever the queue dropped
+    void forward(BoundedQueue<Frame*> &queue, Frame* frame);
+
+    void print_stats();
+
+    // Frames can only be dropped before estimation if every estimator is stateless
+    static DropPolicy pre_estimation_policy(const PipelineSettings &settings, const EstimationExecutor &estimation);
+};
+
+#endif // FRAME_PIPELINE_H
@@ -0,0 +1,88 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#include <Eigen/Core>
+#include <opencv2/core/core.hpp>
+#include "util/geometry_util.h"
+#include "util/shader_util.h"
+
+// A Frame holds everything needed to render a single camera frame.
+// Frames are owned by a FramePool and handed between threads by pointer.
+struct Frame
+{
+    int index;
+    double timestamp;
+
+    // Steady clock times at which the frame was captured and each stage finished with it
+    int64_t capture_ns;
+    int64_t tracked_ns;
+    int64_t completed_ns;
+    int64_t submitted_ns;
+
+    cv::Mat rgb_image;
+    cv::Mat depth_image;
+    cv::Mat completed_depth;
+
+    // Tracking results, where each key point has a tracked point at the same index.
+    // The world to camera pose is only meaningful while tracking is OK.
+    Eigen::Matrix4f camera_pose;
+    int tracking_state;
+    std::vector<TrackedPoint> tracked_points;
+    std::vector<cv::KeyPoint> key_points;
+
+    std::vector<Light> lights;
+};
+
+// The FramePool preallocates a fixed number of frames, which are recycled
+// between the main loop and the renderer instead of being copied.
+class FramePool
+{
+private:
+    // Buffer addresses of a frame, used to detect when a buffer was reallocated
+    struct FrameBuffers
+    {
+        const void* rgb_image;
+        const void* depth_image;
+        const void* completed_depth;
+        const void* tracked_points;
+        const void* key_points;
+        const void* lights;
+    };
+
+    std::vector<Frame> m_frames;
+    std::vector<FrameBuffers> m_buffers;
+    std::vector<Frame*> m_free_frames;
+
+    std::mutex m_pool_mutex;
+    std::condition_variable m_frame_released;
+
+    std::atomic<int> m_allocations;
+
+public:
+    FramePool(int size, int width, int height, int max_key_points, int max_lights);
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    // Blocks until a frame is available, and the caller owns it until it's released
+    Frame* acquire();
+    void release(Frame* frame);
+
+    // The number of times one of the pooled frame buffers had to be reallocated after the
+    // pool was created, which should stay at 0 as long as every frame has the same resolution.
+    // This only covers the frame's own storage: ORB-SLAM3 returns its tracked map points and
+    // key points in new vectors every frame, which are then copied into the pooled ones.
+    int get_allocation_count() const;
+
+private:
+    FrameBuffers get_buffers(const Frame &frame) const;
+};
+
+#endif // FRAME_POOL_H
@@ -0,0 +1,103 @@
+#ifndef LIGHT_CULLING_H
+#define LIGHT_CULLING_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <opencv2/core/core.hpp>
+
+#include "util/matrix_util.h"
+#include "util/shader_util.h"
+
+// The LightGrid bins lights into screen-space tiles on the CPU, so that the deferred pass
+// only shades each pixel with the lights that can reach it. Virtual objects are never shaded
+// behind the real depth, so each tile only reaches as far as the farthest completed depth in it.
+//
+// Each light reaches a bounded range, past which the shader fades it out completely. The
+// range grows with the square root of the light's brightness and intensity, and is set
+// for a white light of intensity 1 with set_light_range().
+//
+// Lights and lists are read by the shader from two texture buffers. Every light takes two
+// texels of the data buffer: its position and range, then its color and intensity. The list
+// buffer starts with the offset and count of each tile's light indices, followed by the indices.
+class LightGrid
+{
+public:
+    static const int TILE_SIZE = 32;
+
+    // Tiles keep the brightest lights when more than this many reach them
+    static const int MAX_LIGHTS_PER_TILE = 64;
+
+    // How far a white light of intensity 1 reaches by default, in meters
+    static constexpr float DEFAULT_LIGHT_RANGE = 1.0f;
+
+private:
+    int m_width, m_height;
+    float m_fx, m_fy, m_cx, m_cy;
+    int m_tiles_x, m_tiles_y;
+    float m_light_range;
+
+    // Per tile, the farthest depth it's shaded at, or 0 if no pixel in it is shaded
+    std::vector<float> m_tile_max_depth;
+
+    // Planes through the camera center along the tile boundaries, which contain
+    // the points projected to the right of (or below) each boundary
+    std::vector<Eigen::Vector3f> m_column_planes;
+    std::vector<Eigen::Vector3f> m_row_planes;
+
+    // Scratch space reused between frames
+    std::vector<int> m_order;
+    std::vector<uchar> m_column_hits, m_row_hits;
+    std::vector<int> m_tile_counts;
+    std::vector<int32_t> m_tile_lights;
+
+    // What's uploaded to the texture buffers
+    std::vector<glm::vec4> m_light_data;
+    std::vector<int32_t> m_light_lists;
+    int m_num_lights;
+
+    // Lights that reached a tile after it was already full, in the last frame
+    int m_dropped_tile_lights;
+    bool m_warned_full_tiles;
+
+    GLuint m_data_buffer, m_data_texture;
+    GLuint m_list_buffer, m_list_texture;
+
+public:
+    LightGrid(int width, int height, const std::string &camera_settings);
+
+    // Creates the texture buffers, which needs a GL context
+    void init_buffers();
+
+    void set_light_range(float light_range);
+
+    // Bounds the depth of each tile by the completed depth of the image
+    void set_depth(const cv::Mat &completed_depth);
+
+    // Bins the lights into tiles as seen from the given world to camera pose
+    void cull(const std::vector<Light> &lights, const Eigen::Matrix4f &camera_pose);
+
+    // Uploads the lights and lists, and binds them to the given texture units
+    void upload(GLenum data_unit, GLenum list_unit);
+
+    int get_tiles_x() const;
+    int get_tiles_y() const;
+    int get_light_count() const;
+    double get_average_tile_lights() const;
+    int get_max_tile_lights() const;
+    int get_dropped_tile_lights() const;
+
+    // How far a light reaches before it's faded out
+    float get_light_range(const Light &light) const;
+};
+
+#endif // LIGHT_CULLING_H
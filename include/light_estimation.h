@@ -26,6 +26,11 @@ public:
 
     virtual void estimate_lights(const cv::Mat &rgb_image, const cv::Mat &depth_image) = 0;
     const std::vector<Light>& get_lights() const;
+
+    // Thread-safe implementations can run on any thread, alongside depth completion.
+    // Stateful implementations depend on previous frames, so they have to see every frame in order.
+    virtual bool is_thread_safe() const;
+    virtual bool is_stateful() const;
 };
 
 // This implementation randomly generates positions to approximate light sources.
@@ -39,6 +44,10 @@ public:
 
     virtual void estimate_lights(const cv::Mat &rgb_image, const cv::Mat &depth_image);
 
+    // std::rand() isn't thread-safe, and lights are only estimated once
+    virtual bool is_thread_safe() const;
+    virtual bool is_stateful() const;
+
 private:
     // Helper function to normalize random number generation
     float rand_float() const;
@@ -51,6 +60,9 @@ public:
     ConstLightEstimator(int num_lights);
 
     virtual void estimate_lights(const cv::Mat &rgb_image, const cv::Mat &depth_image);
+
+    virtual bool is_thread_safe() const;
+    virtual bool is_stateful() const;
 };
 
 
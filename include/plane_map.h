@@ -0,0 +1,91 @@
+#ifndef PLANE_MAP_H
+#define PLANE_MAP_H
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+#include <opencv2/core/core.hpp>
+
+#include "util/geometry_util.h"
+
+// A plane fit to the map points assigned to it. Only the running sums of the points are kept,
+// so assigning, moving or removing a point is O(1), and refitting is a direct 3x3 eigen solve.
+struct MapPlane
+{
+    double count;
+    Eigen::Vector3d sum;
+    Eigen::Matrix3d sum_squares;
+
+    // Result of the last refit
+    Eigen::Vector3f centroid;
+    Eigen::Vector3f normal;
+    float thickness;    // RMS distance of the points to the plane
+    float extent;       // RMS distance of the points to the centroid along the widest direction
+    bool changed;
+
+    // Objects placed on the plane follow it as it's refined
+    std::vector<Plane*> anchors;
+
+    // A negative weight removes a point again
+    void add_point(const Eigen::Vector3f &point, double weight);
+    bool refit();
+
+    // How far points can be from the plane, and from its centroid, to be assigned to it
+    float get_reach() const;
+    float get_extent_reach() const;
+};
+
+// The PlaneMap keeps detected planes alive between objects. Newly tracked map points are
+// assigned to the planes they lie on, planes are refit as they gain points, and fragments of
+// the same plane are merged. Objects can then be placed on a known plane without another RANSAC.
+class PlaneMap
+{
+private:
+    // Plane each map point was assigned to, and its position when it was added
+    struct Assignment
+    {
+        int plane;
+        Eigen::Vector3f position;
+    };
+
+    std::map<int, MapPlane> m_planes;
+    std::unordered_map<long, Assignment> m_assignments;
+    int m_next_id;
+
+public:
+    PlaneMap();
+
+    // Assigns new map points to planes and follows points the SLAM map moved or culled,
+    // then refits the planes that changed, along with the objects anchored to them.
+    void update(const std::vector<TrackedPoint> &points);
+
+    // Starts tracking a newly detected plane through the object placed on it,
+    // assigning the given points that lie on it.
+    void add_plane(Plane* object, const std::vector<TrackedPoint> &points);
+
+    // Places a new object on the known plane with the most of the given points,
+    // or returns nullptr if none of the known planes is visible enough.
+    Plane* anchor_object(const std::vector<TrackedPoint> &points);
+
+    int get_plane_count() const;
+
+private:
+    int find_plane(const Eigen::Vector3f &position) const;
+    void assign_point(long id, int plane, const Eigen::Vector3f &position);
+    void unassign_point(std::unordered_map<long, Assignment>::iterator it);
+    void refit_planes();
+    void merge_planes();
+    void update_anchors(MapPlane &plane);
+};
+
+#endif // PLANE_MAP_H
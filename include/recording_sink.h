@@ -0,0 +1,91 @@
+#ifndef RECORDING_SINK_H
+#define RECORDING_SINK_H
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "util/bounded_queue.h"
+#include "util/profile_util.h"
+
+// How recorded frames are written out
+enum class RecordingFormat
+{
+    VIDEO,  // compressed video container through cv::VideoWriter (.mp4, .avi, .mkv)
+    Y4M,    // uncompressed YUV 4:2:0 stream that most encoders read directly (.y4m)
+    RAW,    // lossless BGR frames back to back (.bgr), readable as rawvideo
+    PNG,    // one zero-padded PNG per frame in a directory
+};
+
+struct RecordingStats
+{
+    int written;
+    int dropped;
+    int max_queued;
+    double write_ms;
+};
+
+// The RecordingSink encodes frames on its own thread. Frames are copied into
+// recycled buffers and queued, so whoever writes them doesn't wait on the encoder,
+// and by default frames are dropped instead once the queue is full.
+class RecordingSink
+{
+private:
+    struct RecordedFrame
+    {
+        int index;
+        cv::Mat image;
+    };
+
+    std::string m_path;
+    RecordingFormat m_format;
+    int m_width, m_height;
+    double m_fps;
+
+    BoundedQueue<RecordedFrame> m_queue;
+    std::thread m_thread;
+
+    // Buffers that already went through the encoder, reused for new frames
+    std::mutex m_free_mutex;
+    std::vector<cv::Mat> m_free_images;
+
+    cv::VideoWriter m_video;
+    std::FILE* m_file;
+    cv::Mat m_yuv;
+
+    int m_written;
+    double m_write_ms;
+
+public:
+    // The format is chosen from the extension of the path, where anything else is a directory of PNGs.
+    // Frames that don't fit in the queue are dropped, unless the policy is to block.
+    RecordingSink(const std::string &path, int width, int height, double fps, size_t queue_capacity, DropPolicy policy = DropPolicy::DROP_NEWEST);
+    ~RecordingSink();
+
+    // Copies the image, so it can be reused as soon as this returns
+    void write(int index, const cv::Mat &image);
+
+    // Waits for every queued frame to be written, then closes the output
+    void close();
+
+    // Written frame counts are only final once close() returns
+    RecordingStats get_stats();
+    static RecordingFormat format_from_path(const std::string &path);
+
+private:
+    void run();
+    void open();
+    void encode(const RecordedFrame &frame);
+};
+
+#endif // RECORDING_SINK_H
@@ -1,9 +1,15 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <limits>
 #include <iostream>
 #include <mutex>
+#include <tuple>
 #include <vector>
 
 #include <imgui.h>
@@ -19,8 +25,14 @@
 
 #include "util/geometry_util.h"
 #include "util/matrix_util.h"
+#include "util/profile_util.h"
 #include "util/shader_util.h"
+#include "util/sync_util.h"
+#include "frame_latency.h"
+#include "frame_pool.h"
+#include "light_culling.h"
 #include "light_estimation.h"
+#include "plane_map.h"
 
 class Renderer
 {
@@ -29,20 +41,23 @@ private:
     size_t m_width, m_height;
     size_t m_scaled_width, m_scaled_height;
     GLFWwindow* m_window;
-    std::string m_shader_dir, m_model_path, m_camera_settings;
 
-    // Info needed to render or add an object
-    std::mutex m_slam_mutex;
-    cv::Mat m_camera_pose;
-    std::vector<ORB_SLAM3::MapPoint*> m_map_points;
-    std::vector<cv::KeyPoint> m_key_points;
+    // Headless renderers draw into an offscreen framebuffer without a visible window or UI,
+    // render every frame they're given exactly once, and never drop frames.
+    bool m_headless;
+    GLuint m_output_fbo;
+    std::mutex m_handoff_mutex;
+    std::condition_variable m_handoff;
+    std::string m_shader_dir, m_model_path, m_camera_settings;
 
-    std::mutex m_image_mutex;
-    cv::Mat m_background_image;
-    cv::Mat m_completed_depth;
+    // Info needed to render or add an object. The main loop publishes the newest frame
+    // without waiting on the renderer, and frames that were never drawn (or are no longer
+    // drawn) are returned to the pool.
+    FramePool &m_frame_pool;
+    std::atomic<Frame*> m_pending_frame;
+    Frame* m_frame;
 
-    std::mutex m_light_mutex;
-    std::vector<Light> m_lights;
+    TripleBuffer<std::vector<Light>> m_lights;
 
     // Geometry pass rendering
     Scene m_scene;
@@ -51,57 +66,116 @@ private:
     glm::mat4 m_persp;
     std::vector<Model> m_models;
 
+    // View, projection and the light tiles are shared by the shaders through a uniform buffer
+    GLuint m_frame_ubo;
+    FrameUniforms m_frame_uniforms;
+
     // Deferred pass rendering
     Shader m_deferred_shader;
     GLuint m_positions, m_normals, m_diff_spec;
 
+    // Lights are culled per screen tile, so each pixel is only shaded with the lights that reach it
+    LightGrid m_light_grid;
+
     // Quad rendering objects
     Shader m_image_shader;
     GLuint m_quad_vao;
     GLuint m_background_texture, m_depth_texture;
 
+    // Depth is converted to half floats straight into a ring of pixel buffers, so the
+    // texture upload moves half the data and doesn't stall the render thread.
+    static const int NUM_DEPTH_BUFFERS = 3;
+    GLuint m_depth_buffers[NUM_DEPTH_BUFFERS];
+    int m_depth_buffer_index;
+
     // Flags to control renderer behavior
     bool m_image_updated;
     bool m_draw_key_points;
     bool m_add_object;
-    bool m_copy_pixel_data;
-    bool m_should_close;
+    std::atomic<bool> m_copy_pixel_data;
+    std::atomic<bool> m_should_close;
 
-    // Externally check when an object was added
+    // Objects are added and checked from other threads, but these locks
+    // are only held long enough to exchange pointers.
     std::mutex m_object_mutex;
-    Plane* m_last_object_added;
-
-    // Externally access the rendered image
-    std::mutex m_render_mutex;
-    cv::Mat m_image;
+    std::vector<Plane*> m_pending_objects;
+    std::tuple<Eigen::Vector3f, Eigen::Vector3f, float> m_last_object_added;
+    bool m_object_added;
+
+    // Detected planes are kept and refined, so objects can be placed without detecting them again
+    PlaneMap m_plane_map;
+
+    // Externally access the rendered image. Frames are read back through a ring of pixel
+    // buffers with fences, so the render thread never waits for the GPU to finish, and
+    // finished images are handed over without locks.
+    static const int NUM_READBACK_BUFFERS = 3;
+    GLuint m_readback_buffers[NUM_READBACK_BUFFERS];
+    GLsync m_readback_fences[NUM_READBACK_BUFFERS];
+    int m_readback_next;
+    int m_readback_pending;
+    int m_readback_indices[NUM_READBACK_BUFFERS];
+    TripleBuffer<cv::Mat> m_images;
+    std::function<void(int, const cv::Mat&)> m_on_readback;
+
+    // Time spent waiting on locks, split by the thread that waited
+    std::atomic<int64_t> m_render_wait_ns;
+    std::atomic<int64_t> m_producer_wait_ns;
+    float m_render_wait_ms;
+    float m_producer_wait_ms;
+
+    // When profiling, the geometry and deferred passes are timed on the GPU. Timestamps
+    // are read a few frames later, once the GPU got to them, so the render thread never waits.
+    static const int NUM_TIMER_FRAMES = 4;
+    static const int NUM_TIMESTAMPS = 3;
+    GLuint m_timer_queries[NUM_TIMER_FRAMES][NUM_TIMESTAMPS];
+    bool m_timer_pending[NUM_TIMER_FRAMES];
+    int m_timer_frame;
+    int64_t m_gpu_clock_offset_ns;
+    int m_gpu_track;
+
+    // How stale the presented frames are
+    LatencyMonitor m_latency;
 
     // Timestep for animation
     std::chrono::time_point<std::chrono::system_clock> m_last_frame;
 
 public:
     // Some things need to be initialized/destroyed before/after the main loop
-    Renderer(size_t width, size_t height, float scale, const std::string &settings, const std::string &shaders, const std::string &model_path);
+    Renderer(size_t width, size_t height, float scale, const std::string &settings, const std::string &shaders, const std::string &model_path, FramePool &frame_pool, bool headless = false);
     ~Renderer();
 
     // Main event loop and mark when to close
     void run();
     void close();
 
-    // Pass info from another thread to the renderer thread
-    void set_slam(const cv::Mat &pose, 
-                  const std::vector<ORB_SLAM3::MapPoint*> &map_points,
-                  const std::vector<cv::KeyPoint> &key_points);
-
-    void set_images(const cv::Mat &rgb_image, const cv::Mat &depth_image);
+    // Pass info from another thread to the renderer thread.
+    // The renderer takes ownership of the frame and releases it back to the pool.
+    void set_frame(Frame* frame);
 
     void set_lights(const std::vector<Light> &lights);
 
-    void add_object(const cv::Mat &origin, const cv::Mat &normal, float orientation);
+    void add_object(const Eigen::Vector3f &origin, const Eigen::Vector3f &normal, float orientation);
     
     // When recording, the main loop needs access to certain information from the renderer
-    Plane* get_most_recent_object();
+    // Placement of the object added since the last call, if there was one
+    bool get_most_recent_object(std::tuple<Eigen::Vector3f, Eigen::Vector3f, float> &information);
+    // The returned image is only valid until the next call
     cv::Mat get_most_recent_frame();
 
+    // Instead, every rendered frame can be read back and passed to a callback on the
+    // render thread, along with the frame index. This has to be set before run().
+    void set_readback_callback(const std::function<void(int, const cv::Mat&)> &on_readback);
+
+    // How far a white light of intensity 1 reaches, in meters. This has to be set before run().
+    void set_light_range(float light_range);
+
+    // The latency of every presented frame is written to the given CSV file as it's
+    // presented. This has to be set before run().
+    bool set_latency_csv(const std::string &filepath);
+
+    // Only safe to access once the renderer stopped
+    LatencyMonitor& get_latency_monitor();
+
 private:
     // Initialization helpers
     void init_window();
@@ -111,17 +185,31 @@ private:
     void init_images();
     void init_scene();
     void init_ui();
+    void init_timers();
+
+    // Pick up whatever was handed over since the last frame. Headless
+    // renderers first wait for a new frame, and stop once closed and drained.
+    bool wait_for_frame();
+    void update_state();
 
     // Renderer drawing helpers
     void draw_key_points();
     void draw_background_image();
+    void update_frame_uniforms();
     void draw_scene();
     void draw_ui();
+    void upload_depth();
 
     // Utility for accessing the OpenGL render,
     // which cannot be done on the other thread 
     // because OpenGL functions are called
     void copy_pixel_data();
+    void finish_readbacks(bool wait);
+    bool finish_oldest_readback(GLuint64 timeout_ns);
+
+    // GPU timer queries, which do nothing unless profiling is compiled in and enabled
+    void write_timestamp(int stamp);
+    void read_timestamps();
 };
 
 #endif // RENDERER_H
\ No newline at end of file
@@ -0,0 +1,59 @@
+#ifndef SLAM_TRACE_H
+#define SLAM_TRACE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <opencv2/core/core.hpp>
+
+#include "frame_pool.h"
+
+// A SLAM trace records the tracking results of every frame from a live run: the camera
+// pose, tracking state, tracked key points, and a snapshot of their map points. Replaying
+// a trace reproduces the same frames without running SLAM, so everything after tracking
+// can be benchmarked and compared between runs deterministically.
+//
+// The file is a header ("MRTRACE" and a version) followed by one record per tracked frame,
+// with every field written little-endian whatever the host byte order. Frames dropped
+// before tracking in the live run have no record.
+class SlamTraceWriter
+{
+private:
+    std::ofstream m_file;
+    int m_frames;
+
+public:
+    SlamTraceWriter(const std::string &filepath);
+    ~SlamTraceWriter();
+
+    void write(const Frame &frame);
+};
+
+class SlamTraceReader
+{
+private:
+    std::ifstream m_file;
+    int m_next_index;
+    bool m_done;
+
+    // Records of frames that are skipped over are read into here
+    Frame m_skipped;
+
+public:
+    SlamTraceReader(const std::string &filepath);
+
+    // Fills in the tracking results of the frame with the same index. Frames have to
+    // be read in increasing order, and false is returned if the trace skipped the frame.
+    bool read(Frame &frame);
+
+private:
+    void read_record(Frame &frame);
+    void read_index();
+};
+
+#endif // SLAM_TRACE_H
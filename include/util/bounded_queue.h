@@ -0,0 +1,122 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+// What to do when pushing into a full queue
+enum class DropPolicy
+{
+    BLOCK,          // wait for the consumer, never dropping anything
+    DROP_OLDEST,    // drop the oldest queued item to make room
+    DROP_NEWEST,    // drop the item being pushed
+};
+
+struct QueueStats
+{
+    int pushed;
+    int dropped;
+    int max_depth;
+};
+
+// A fixed-capacity queue between two pipeline stages.
+// Closing the queue wakes up both sides, and pop() fails once it's drained.
+template <typename T>
+class BoundedQueue
+{
+private:
+    std::deque<T> m_items;
+    size_t m_capacity;
+    DropPolicy m_policy;
+    bool m_closed;
+
+    std::mutex m_mutex;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
+
+    QueueStats m_stats;
+
+public:
+    BoundedQueue(size_t capacity, DropPolicy policy) :
+        m_capacity{capacity > 0 ? capacity : 1},
+        m_policy{policy},
+        m_closed{false},
+        m_stats{0, 0, 0}
+    {
+
+    }
+
+    // Returns the item that was dropped to honor the drop policy, if any,
+    // so the caller can recycle it. Pushing into a closed queue drops the item.
+    std::optional<T> push(T item)
+    {
+        std::optional<T> dropped;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            if (m_policy == DropPolicy::BLOCK) {
+                m_not_full.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+            }
+
+            if (m_closed) {
+                return item;
+            }
+
+            if (m_items.size() >= m_capacity) {
+                m_stats.dropped++;
+                if (m_policy == DropPolicy::DROP_NEWEST) {
+                    return item;
+                }
+                dropped = std::move(m_items.front());
+                m_items.pop_front();
+            }
+
+            m_items.push_back(std::move(item));
+            m_stats.pushed++;
+            m_stats.max_depth = std::max(m_stats.max_depth, static_cast<int>(m_items.size()));
+        }
+        m_not_empty.notify_one();
+
+        return dropped;
+    }
+
+    // Blocks until an item is available, or returns false once the queue is closed and empty
+    bool pop(T &item)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_not_empty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+
+            if (m_items.empty()) {
+                return false;
+            }
+
+            item = std::move(m_items.front());
+            m_items.pop_front();
+        }
+        m_not_full.notify_one();
+
+        return true;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_not_empty.notify_all();
+        m_not_full.notify_all();
+    }
+
+    QueueStats get_stats()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+};
+
+#endif // BOUNDED_QUEUE_H
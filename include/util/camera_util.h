@@ -15,6 +15,9 @@ enum class OfflineDatasetType
 
 std::vector<std::tuple<std::string, std::string, double>> load_offline_dataset(const std::string &dataset_dir, OfflineDatasetType type);
 
+// The resolution that frames of each dataset are processed at
+void set_dataset_resolution(OfflineDatasetType type, int &width, int &height);
+
 std::tuple<std::string, std::string, double> process_eth3d(const std::string &line);
 std::tuple<std::string, std::string, double> process_scannet(const std::string &line);
 
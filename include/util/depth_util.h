@@ -0,0 +1,21 @@
+#ifndef DEPTH_UTIL_H
+#define DEPTH_UTIL_H
+
+#include <algorithm>
+#include <utility>
+#include <cmath>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+// Converts a row of raw sensor depth to metric depth, where every
+// depth at or below min_valid is replaced with the fill value.
+void convert_depth_row(const ushort* src, float* dst, int n, float scale, float min_valid, float fill);
+
+// Converts raw sensor depth (CV_16UC1) to metric depth (CV_32FC1) of the given size in a single pass.
+// Invalid depths are filled before resampling, and the image is resampled bilinearly with the
+// same pixel mapping as cv::resize, so the source is never converted to a full float image first.
+void convert_depth(const cv::Mat &raw_depth, cv::Mat &depth, cv::Size size, float scale, float min_valid, float fill);
+
+#endif // DEPTH_UTIL_H
@@ -1,19 +1,25 @@
 #ifndef GEOMETRY_UTIL_H
 #define GEOMETRY_UTIL_H
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
 #include <tuple>
 #include <vector>
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <opencv2/core/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 #include <MapPoint.h>
 #include <stb_image.h>
 
@@ -40,28 +46,62 @@ const int quad_indices[] = {
     3, 2, 0
 };
 
+// A snapshot of the map point matched to a tracked key point. Frames hold onto
+// these instead of pointers into the SLAM map, which keeps changing (and may
+// not exist at all when tracking is replayed from a trace).
+struct TrackedPoint
+{
+    long id;            // -1 when the key point isn't matched to a map point
+    cv::Point3f position;
+    int observations;
+    bool bad;
+};
+
 // A Plane defines the local coordinate space for each inserted object.
 class Plane
 {
 private:
-    cv::Mat m_origin, m_normal;
+    Eigen::Vector3f m_origin, m_normal;
     float m_orientation;
     glm::mat4 m_model_matrix;
 
 public:
-    Plane(const cv::Mat &origin, const cv::Mat &normal, float orienation);
-    Plane(const std::vector<ORB_SLAM3::MapPoint*> &plane_points, const cv::Mat &camera_pose);
+    Plane(const Eigen::Vector3f &origin, const Eigen::Vector3f &normal, float orienation);
+    Plane(const std::vector<TrackedPoint> &plane_points, const Eigen::Matrix4f &camera_pose);
 
     const glm::mat4& get_model_matrix() const;
-    std::tuple<cv::Mat, cv::Mat, float> get_plane_information() const;
+    std::tuple<Eigen::Vector3f, Eigen::Vector3f, float> get_plane_information() const;
+
+    // Moves the plane, keeping its orientation around the normal
+    void set_plane(const Eigen::Vector3f &origin, const Eigen::Vector3f &normal);
 
 private:
     void recompute_model_matrix();
 };
 
-Plane* detect_plane(const std::vector<ORB_SLAM3::MapPoint*> &curr_map_points,
+// By default, RANSAC stops as soon as enough hypotheses were tried to find an all-inlier
+// sample with the given confidence, and draws samples from the most observed points first.
+// Without either, it always tries max_iterations uniformly drawn samples.
+struct RansacSettings
+{
+    bool adaptive = true;
+    bool prioritize_observed = true;
+    float confidence = 0.99f;
+    int max_iterations = 50;
+};
+
+struct RansacStats
+{
+    int iterations;
+    int inliers;
+    float best_distance;
+};
+
+Plane* detect_plane(const std::vector<TrackedPoint> &curr_map_points,
                     const std::vector<cv::KeyPoint> &curr_key_points,
-                    const cv::Mat &curr_camera_pose);
+                    const Eigen::Matrix4f &curr_camera_pose,
+                    const RansacSettings &settings = RansacSettings(),
+                    RansacStats* stats = nullptr);
 
 struct Vertex 
 {
@@ -82,6 +122,14 @@ struct Texture
     std::string filepath;
 };
 
+// Per-object attributes, which are streamed to the GPU once per frame so that
+// every object in the scene is drawn with one instanced draw call per mesh.
+struct InstanceData
+{
+    glm::mat4 plane;
+    glm::mat4 local;
+};
+
 // A Mesh contains the actual geometry data.
 class Mesh 
 {
@@ -94,7 +142,10 @@ private:
 
 public:
     Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures);
-    void draw(Shader &shader);
+
+    // Reads InstanceData from the given buffer, advancing once per instance
+    void set_instance_buffer(unsigned int instance_vbo);
+    void draw(Shader &shader, int instances);
 
 private:
     void setup_mesh();
@@ -111,7 +162,8 @@ private:
 public:
     Model() = default;
     Model(const std::string &filepath);
-    void draw(Shader &shader);
+    void set_instance_buffer(unsigned int instance_vbo);
+    void draw(Shader &shader, int instances);
 
 private:
     // Helper loader functions
@@ -144,6 +196,11 @@ private:
     std::vector<Plane*> m_planes;
     std::vector<Transformation> m_transforms;
 
+    // Matrices of all objects, in a buffer that only grows
+    std::vector<InstanceData> m_instances;
+    unsigned int m_instance_vbo;
+    size_t m_instance_capacity;
+
 public:
     Scene(const std::string &filepath);
     void load();
@@ -151,6 +208,9 @@ public:
     void draw(Shader &shader);
     void add_object(Plane *plane);
     void update(float timestep);
+
+private:
+    void upload_instances();
 };
 
 #endif // GEOMETRY_UTIL_H
\ No newline at end of file
@@ -1,14 +1,64 @@
 #ifndef MATRIX_UTIL_H
 #define MATRIX_UTIL_H
 
+#include <cmath>
+#include <string>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
 #include <glm/matrix.hpp>
 #include <opencv2/core/core.hpp>
 
-const float EPSILON = 1e-4;
-cv::Mat ExpSO3(float x, float y, float z);
-cv::Mat ExpSO3(const cv::Mat &v);
+// Poses, rotations and planes are fixed-size Eigen types, so per-frame geometry
+// never allocates. Eigen and glm are both column-major, so they convert with a copy.
+constexpr float EPSILON = 1e-4f;
+
+inline Eigen::Matrix3f ExpSO3(float x, float y, float z)
+{
+    const float d2 = x * x + y * y + z * z;
+    const float d = std::sqrt(d2);
+    Eigen::Matrix3f W;
+    W <<  0, -z,  y,
+          z,  0, -x,
+         -y,  x,  0;
+    if (d < EPSILON) {
+        return Eigen::Matrix3f::Identity() + W + 0.5f * W * W;
+    }
+
+    return Eigen::Matrix3f::Identity() + W * (std::sin(d) / d) + W * W * ((1.0f - std::cos(d)) / d2);
+}
+
+inline Eigen::Matrix3f ExpSO3(const Eigen::Vector3f &v)
+{
+    return ExpSO3(v(0), v(1), v(2));
+}
+
+// Inverse of a rigid transform, without a general 4x4 inversion
+inline Eigen::Matrix4f inverse_pose(const Eigen::Matrix4f &pose)
+{
+    Eigen::Matrix4f inverse = Eigen::Matrix4f::Identity();
+    inverse.topLeftCorner<3, 3>() = pose.topLeftCorner<3, 3>().transpose();
+    inverse.topRightCorner<3, 1>() = -pose.topLeftCorner<3, 3>().transpose() * pose.topRightCorner<3, 1>();
+    return inverse;
+}
+
+// Position of the camera in the world, given its world to camera pose
+inline Eigen::Vector3f camera_center(const Eigen::Matrix4f &pose)
+{
+    return -pose.topLeftCorner<3, 3>().transpose() * pose.topRightCorner<3, 1>();
+}
+
+inline glm::mat4 glm_from_eigen(const Eigen::Matrix4f &matrix)
+{
+    glm::mat4 glm_matrix;
+    for (int c = 0; c < 4; c++) {
+        for (int r = 0; r < 4; r++) {
+            glm_matrix[c][r] = matrix(r, c);
+        }
+    }
+    return glm_matrix;
+}
 
 glm::mat4 camera_projection(size_t width, size_t height, const std::string &camera_settings);
-glm::mat4 glm_from_cv(const cv::Mat &cv_matrix);
 
-#endif // MATRIX_UTIL_H
\ No newline at end of file
+#endif // MATRIX_UTIL_H
@@ -0,0 +1,100 @@
+#ifndef PACKED_DATASET_H
+#define PACKED_DATASET_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "util/camera_util.h"
+
+// A packed dataset stores every frame of an offline dataset in a single file,
+// so that frames can be memory-mapped instead of decoded from thousands of images.
+//
+// Layout: [PackedHeader][frame planes...][PackedFrame index][string table]
+// Each plane is stored raw (row-major, no padding) at a 64 byte aligned offset.
+const char PACKED_MAGIC[8] = {'M', 'R', 'P', 'A', 'C', 'K', '\0', '\0'};
+const uint32_t PACKED_VERSION = 1;
+const uint64_t PACKED_ALIGNMENT = 64;
+
+struct PackedHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t dataset_type;
+    uint32_t frame_count;
+    uint32_t reserved;
+    uint64_t index_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t source_dir;
+};
+
+struct PackedPlane
+{
+    uint64_t offset;
+    int32_t rows, cols, type;
+    uint32_t name;
+};
+
+struct PackedFrame
+{
+    double timestamp;
+    PackedPlane rgb;
+    PackedPlane depth;
+};
+
+// Converts an offline dataset into a packed dataset file
+void write_packed_dataset(const std::string &dataset_dir, OfflineDatasetType type, const std::string &output_path);
+
+// Read-only view over a memory-mapped packed dataset
+class PackedDataset
+{
+private:
+    int m_fd;
+    uint8_t* m_data;
+    size_t m_size;
+
+    const PackedHeader* m_header;
+    const PackedFrame* m_frames;
+    const char* m_strings;
+
+public:
+    PackedDataset(const std::string &filepath);
+    ~PackedDataset();
+
+    PackedDataset(const PackedDataset&) = delete;
+    PackedDataset& operator=(const PackedDataset&) = delete;
+
+    int get_frame_count() const;
+    OfflineDatasetType get_dataset_type() const;
+    std::string get_source_dir() const;
+
+    // The returned matrices point directly into the mapping
+    cv::Mat get_rgb(int index) const;
+    cv::Mat get_depth(int index) const;
+    double get_timestamp(int index) const;
+
+    // The original association table, in the same format as load_offline_dataset()
+    std::vector<std::tuple<std::string, std::string, double>> get_associations() const;
+
+    // Hint to the kernel that a frame will be read soon
+    void prefetch(int index) const;
+
+private:
+    cv::Mat get_plane(const PackedPlane &plane) const;
+    bool valid_plane(const PackedPlane &plane) const;
+    void unmap();
+};
+
+bool is_packed_dataset(const std::string &filepath);
+
+#endif // PACKED_DATASET_H
@@ -0,0 +1,116 @@
+#ifndef PROFILE_UTIL_H
+#define PROFILE_UTIL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Lightweight instrumentation for finding where a frame's time goes. Every thread
+// records spans into its own ring buffer without locking, and at exit the spans are
+// written as a Chrome trace (chrome://tracing or ui.perfetto.dev) and summarized.
+//
+// Profiling is compiled in with MIXED_REALITY_PROFILING, and only records anything
+// once enabled at runtime. Until then, a scope costs a single relaxed atomic load.
+
+// A span of time on the steady clock. Names have to be string literals,
+// because only the pointer is stored.
+struct ProfileEvent
+{
+    const char* name;
+    int64_t start_ns;
+    int64_t duration_ns;
+    int track;
+};
+
+// Events recorded by a single thread. Once full, the oldest events are overwritten.
+class ProfileBuffer
+{
+private:
+    std::vector<ProfileEvent> m_events;
+    std::atomic<uint64_t> m_count;
+    int m_track;
+
+public:
+    ProfileBuffer(size_t capacity, int track);
+
+    // Only called by the thread that owns the buffer
+    void record(const ProfileEvent &event);
+
+    // The events that are still in the buffer, oldest first
+    std::vector<ProfileEvent> get_events() const;
+    uint64_t get_dropped_count() const;
+    int get_track() const;
+};
+
+extern std::atomic<bool> g_profiling_enabled;
+
+inline bool profiling_enabled()
+{
+    return g_profiling_enabled.load(std::memory_order_relaxed);
+}
+
+inline int64_t profile_clock_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Has to be called before the threads that should be profiled start recording
+void enable_profiling();
+
+// Names the calling thread in the trace
+void set_profile_thread_name(const std::string &name);
+
+// Adds a track for events that don't happen on any CPU thread, such as GPU work
+int add_profile_track(const std::string &name);
+
+// The event goes on the track of the calling thread, unless another track is given
+void record_profile_event(const char* name, int64_t start_ns, int64_t duration_ns, int track = -1);
+
+// Should only be called once the profiled threads stopped recording
+bool write_profile_trace(const std::string &filepath);
+void print_profile_summary();
+
+// Records the lifetime of the scope it's declared in
+class ScopedTimer
+{
+private:
+    const char* m_name;
+    int64_t m_start_ns;
+
+public:
+    explicit ScopedTimer(const char* name) :
+        m_name{name},
+        m_start_ns{profiling_enabled() ? profile_clock_ns() : -1}
+    {
+
+    }
+
+    ~ScopedTimer()
+    {
+        if (m_start_ns >= 0) {
+            record_profile_event(m_name, m_start_ns, profile_clock_ns() - m_start_ns);
+        }
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+
+#ifdef MIXED_REALITY_PROFILING
+#define PROFILE_SCOPE(name) ScopedTimer PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name)
+#endif
+
+#endif // PROFILE_UTIL_H
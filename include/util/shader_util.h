@@ -1,10 +1,13 @@
 #ifndef SHADER_UTIL_H
 #define SHADER_UTIL_H
 
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <unordered_map>
+#include <utility>
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
@@ -16,6 +19,47 @@ struct Light
     float intensity;
 };
 
+// Per-frame data shared by all shader programs through a std140 uniform buffer, which is
+// updated once per frame. The layout has to match the FrameData block in the shaders.
+const int FRAME_UNIFORMS_BINDING = 0;
+
+struct FrameUniforms
+{
+    glm::mat4 view;
+    glm::mat4 persp;
+    glm::vec3 view_position;
+    int32_t light_tile_size;
+    glm::ivec2 light_tile_count;
+    glm::vec2 image_size;
+};
+
+static_assert(sizeof(FrameUniforms) == 160, "FrameUniforms doesn't match the std140 layout");
+
+// FNV-1a hash of a uniform name
+constexpr uint32_t uniform_hash(const char* name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name != '\0'; name++) {
+        hash = (hash ^ static_cast<uint8_t>(*name)) * 16777619u;
+    }
+    return hash;
+}
+
+// Uniforms are looked up by the hash of their name. Names are declared as constexpr
+// constants, so the hash is always computed at compile time:
+//
+//     constexpr UniformName UNIFORM_DEPTH_TEXTURE("depthTexture");
+struct UniformName
+{
+    uint32_t hash;
+
+    constexpr explicit UniformName(const char* name) :
+        hash{uniform_hash(name)}
+    {
+
+    }
+};
+
 // Shader creation helpers
 std::string read_shader(const std::string& shader_path);
 int compile_shader(const std::string& shader_path, GLenum type);
@@ -26,16 +70,27 @@ class Shader
 private:
     unsigned int m_id;
 
+    // Locations of all active uniforms, resolved once the program is linked
+    std::unordered_map<uint32_t, GLint> m_uniform_locations;
+
 public:
     Shader() = default;
     Shader(const std::string &vertex_path, const std::string &fragment_path);
     void use();
 
-    // Uniform setters
-    void set_int(const std::string &name, int value) const;
-    void set_float(const std::string &name, float value) const;
-    void set_vec3(const std::string &name, const glm::vec3 &value) const;
-    void set_mat4(const std::string &name, const glm::mat4 &value) const;
+    // Reads the named uniform block from the buffer bound to the given binding point
+    void bind_uniform_block(const char* name, GLuint binding) const;
+
+    // Uniform setters, which ignore uniforms the program doesn't use
+    void set_int(UniformName name, int value) const;
+    void set_float(UniformName name, float value) const;
+    void set_vec3(UniformName name, const glm::vec3 &value) const;
+    void set_mat4(UniformName name, const glm::mat4 &value) const;
+
+private:
+    void cache_uniform_locations();
+    void add_uniform_location(const std::string &name, GLint location);
+    GLint get_uniform_location(UniformName name) const;
 };
 
 #endif // SHADER_UTIL_H
\ No newline at end of file
@@ -0,0 +1,77 @@
+#ifndef SYNC_UTIL_H
+#define SYNC_UTIL_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+// A TripleBuffer exchanges values between a single producer and a single consumer
+// without locks. The producer writes into back() and publishes it, and the consumer
+// picks up the most recently published value with update(). Neither side ever waits
+// on the other, and values that are never picked up are simply overwritten.
+template <typename T>
+class TripleBuffer
+{
+private:
+    static const int INDEX_MASK = 3;
+    static const int DIRTY = 4;
+
+    T m_buffers[3];
+    int m_back;
+    int m_front;
+    std::atomic<int> m_pending;
+
+public:
+    TripleBuffer() :
+        m_back{0},
+        m_front{1},
+        m_pending{2}
+    {
+
+    }
+
+    // Producer side
+    T& back()
+    {
+        return m_buffers[m_back];
+    }
+
+    void publish()
+    {
+        m_back = m_pending.exchange(m_back | DIRTY, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // Consumer side, returns whether a new value was picked up
+    bool update()
+    {
+        if (!(m_pending.load(std::memory_order_relaxed) & DIRTY)) {
+            return false;
+        }
+
+        m_front = m_pending.exchange(m_front, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    T& front()
+    {
+        return m_buffers[m_front];
+    }
+};
+
+// Locks a mutex and adds the time spent waiting for it to a counter (in nanoseconds)
+template <typename Mutex>
+std::unique_lock<Mutex> timed_lock(Mutex &mutex, std::atomic<int64_t> &wait_ns)
+{
+    std::unique_lock<Mutex> lock(mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        const std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+        lock.lock();
+        const std::chrono::time_point<std::chrono::steady_clock> end = std::chrono::steady_clock::now();
+        wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
+
+    return lock;
+}
+
+#endif // SYNC_UTIL_H
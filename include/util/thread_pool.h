@@ -0,0 +1,42 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "util/profile_util.h"
+
+// A fixed set of worker threads that run submitted tasks in order
+class ThreadPool
+{
+private:
+    std::vector<std::thread> m_workers;
+    std::queue<std::packaged_task<void()>> m_tasks;
+
+    std::mutex m_mutex;
+    std::condition_variable m_task_added;
+    bool m_stopping;
+
+public:
+    ThreadPool(int num_threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // The returned future is ready once the task has run,
+    // and rethrows anything the task threw.
+    std::future<void> submit(std::function<void()> task);
+
+    int get_thread_count() const;
+
+private:
+    void run_worker();
+};
+
+#endif // THREAD_POOL_H
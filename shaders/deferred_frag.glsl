@@ -9,16 +9,19 @@ uniform sampler2D depthTexture;
 
 out vec4 fragColor;
 
-struct Light {
-    vec3 position;
-    vec3 color;
-    float intensity;
+// Per-frame data, updated once per frame. It has to match FrameUniforms in shader_util.h
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 persp;
+    vec3 viewPos;
+    int lightTileSize;
+    ivec2 lightTileCount;
+    vec2 imageSize;
 };
 
-const int NUM_LIGHTS = 4;
-uniform Light lights[NUM_LIGHTS];
-
-uniform vec3 viewPos;
+// Lights, and the lights binned into each screen tile, as described in light_culling.h
+uniform samplerBuffer lightData;
+uniform isamplerBuffer lightLists;
 
 void main()
 {
@@ -43,23 +46,35 @@ void main()
     vec3 view_dir = normalize(viewPos - world_pos);
     normal = normalize(normal);
 
+    // Only the lights binned into this pixel's tile can reach it
+    ivec2 pixel = ivec2(vec2(vTexcoord.x, 1.0f - vTexcoord.y) * imageSize);
+    ivec2 tile = clamp(pixel / lightTileSize, ivec2(0), lightTileCount - 1);
+    int tile_index = 2 * (tile.y * lightTileCount.x + tile.x);
+    int offset = texelFetch(lightLists, tile_index).r;
+    int count = texelFetch(lightLists, tile_index + 1).r;
+
     // Add up the contributions from each light
     vec3 color = vec3(0.0f);
-    for (int i = 0; i < NUM_LIGHTS; i++) {
-        vec3 light_dir = normalize(lights[i].position - world_pos);
-        float light_dist = length(lights[i].position - world_pos);
+    for (int i = 0; i < count; i++) {
+        int light = texelFetch(lightLists, offset + i).r;
+        vec4 light_position = texelFetch(lightData, 2 * light);
+        vec3 light_color = texelFetch(lightData, 2 * light + 1).rgb;
+
+        vec3 light_dir = normalize(light_position.xyz - world_pos);
+        float light_dist = length(light_position.xyz - world_pos);
 
         // Diffuse component
         float diffuse_value = max(dot(normal, light_dir), 0.0f);
-        vec3 diffuse_color = diffuse_value * diffuse * lights[i].color;
+        vec3 diffuse_color = diffuse_value * diffuse * light_color;
 
         // Specular component
         vec3 half_dir = normalize(light_dir + view_dir);
         float specular_value = pow(max(dot(normal, half_dir), 0.0f), 16.0f);
-        vec3 specular_color = specular_value * specularity * lights[i].color;
+        vec3 specular_color = specular_value * specularity * light_color;
 
-        // Add components with attenuation
-        float attenuation = 1.0f / (1.0f + 0.5f * light_dist);
+        // Add components with attenuation, which fades out to nothing at the light's range
+        float window = clamp(1.0f - pow(light_dist / light_position.w, 4.0f), 0.0f, 1.0f);
+        float attenuation = window * window / (1.0f + 0.5f * light_dist);
         color += (diffuse_color + specular_color) * attenuation;
     }
 
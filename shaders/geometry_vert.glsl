@@ -4,10 +4,19 @@ layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 tex_coord;
 
-uniform mat4 local;
-uniform mat4 plane;
-uniform mat4 view;
-uniform mat4 persp;
+// Per-instance matrices of the object, taking four locations each
+layout (location = 3) in mat4 plane;
+layout (location = 7) in mat4 local;
+
+// Per-frame data, updated once per frame. It has to match FrameUniforms in shader_util.h
+layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 persp;
+    vec3 viewPos;
+    int lightTileSize;
+    ivec2 lightTileCount;
+    vec2 imageSize;
+};
 
 out vec3 vPosition;
 out vec3 vNormal;
@@ -27,10 +27,15 @@ int CameraStream::get_frame_count() const
 }
 
 // Implementation definitions
-OfflineCameraStream::OfflineCameraStream(const std::string& dataset_dir, OfflineDatasetType type) :
+OfflineCameraStream::OfflineCameraStream(const std::string& dataset_dir, OfflineDatasetType type,
+                                         int num_decoder_threads, int read_ahead) :
     CameraStream{},
     m_dataset_dir{dataset_dir},
-    m_index{0}
+    m_index{0},
+    m_read_ahead{std::max(read_ahead, 1)},
+    m_next_decode{0},
+    m_stop_decoding{false},
+    m_stats{0, 0, 0.0}
 {
     std::vector<std::tuple<std::string, std::string, double>> dataset = load_offline_dataset(dataset_dir, type);
 
@@ -47,28 +52,163 @@ OfflineCameraStream::OfflineCameraStream(const std::string& dataset_dir, Offline
         throw std::runtime_error("[OFFLINE CAMERA]: No RGB images loaded");
     }
 
-    switch (type) {
-        case OfflineDatasetType::ETH3D: {
-            m_width = 736;
-            m_height = 456;
-            break;
+    set_dataset_resolution(type, m_width, m_height);
+
+    std::cout << "[OFFLINE CAMERA]: Read " << m_frame_count << " dataset images" << std::endl;
+
+    // Start decoding ahead of the main loop
+    if (num_decoder_threads > 0) {
+        m_slots.resize(m_read_ahead);
+        for (int i = 0; i < m_read_ahead; i++) {
+            m_slots[i].ready = false;
         }
-        case OfflineDatasetType::SCANNET: {
-            m_width = 1296;
-            m_height = 968;
-            break;
+        for (int i = 0; i < num_decoder_threads; i++) {
+            m_decoders.push_back(std::thread(&OfflineCameraStream::run_decoder, this));
         }
+
+        std::cout << "[OFFLINE CAMERA]: Started " << num_decoder_threads << " decoder threads reading " 
+                  << m_read_ahead << " frames ahead" << std::endl;
     }
+}
 
-    std::cout << "[OFFLINE CAMERA]: Read " << m_frame_count << " dataset images" << std::endl;
+OfflineCameraStream::~OfflineCameraStream()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_decode_mutex);
+        m_stop_decoding = true;
+    }
+    m_slot_freed.notify_all();
+
+    for (int i = 0; i < m_decoders.size(); i++) {
+        m_decoders[i].join();
+    }
+
+    if (!m_decoders.empty()) {
+        std::cout << "[OFFLINE CAMERA]: Decoder starved on " << m_stats.frames_starved << " of " 
+                  << m_stats.frames_returned << " frames (" << m_stats.starved_ms << " ms waiting)" << std::endl;
+    }
 }
 
 std::tuple<cv::Mat, cv::Mat, double> OfflineCameraStream::get_stream()
 {
-    cv::Mat rgb = cv::imread(m_dataset_dir + "/" + m_rgb_images[m_index], cv::IMREAD_UNCHANGED);
-    cv::Mat depth = cv::imread(m_dataset_dir + "/" + m_depth_images[m_index], cv::IMREAD_UNCHANGED);
+    cv::Mat rgb, depth;
     double timestamp = m_timestamps[m_index];
+
+    // Without any decoder threads, decode on the calling thread
+    if (m_decoders.empty()) {
+        decode_frame(m_index, rgb, depth);
+        m_index++;
+        m_stats.frames_returned++;
+        return std::tuple<cv::Mat, cv::Mat, double>(rgb, depth, timestamp);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_decode_mutex);
+        DecodedFrame &slot = m_slots[m_index % m_read_ahead];
+
+        // Frames are always returned in submission order,
+        // so wait if the decoders haven't caught up yet.
+        if (!slot.ready) {
+            const std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+            m_slot_ready.wait(lock, [&slot] { return slot.ready; });
+            const std::chrono::time_point<std::chrono::steady_clock> end = std::chrono::steady_clock::now();
+
+            m_stats.frames_starved++;
+            m_stats.starved_ms += std::chrono::duration<double, std::milli>(end - start).count();
+        }
+
+        rgb = slot.rgb;
+        depth = slot.depth;
+        slot.rgb.release();
+        slot.depth.release();
+        slot.ready = false;
+
+        m_index++;
+        m_stats.frames_returned++;
+    }
+
+    // The slot can now be used for another frame
+    m_slot_freed.notify_all();
+
+    return std::tuple<cv::Mat, cv::Mat, double>(rgb, depth, timestamp);
+}
+
+DecoderStats OfflineCameraStream::get_decoder_stats()
+{
+    std::lock_guard<std::mutex> lock(m_decode_mutex);
+
+    return m_stats;
+}
+
+void OfflineCameraStream::decode_frame(int index, cv::Mat &rgb, cv::Mat &depth) const
+{
+    PROFILE_SCOPE("decode_frame");
+    rgb = cv::imread(m_dataset_dir + "/" + m_rgb_images[index], cv::IMREAD_UNCHANGED);
+    depth = cv::imread(m_dataset_dir + "/" + m_depth_images[index], cv::IMREAD_UNCHANGED);
+}
+
+void OfflineCameraStream::run_decoder()
+{
+    set_profile_thread_name("Decoder");
+    std::unique_lock<std::mutex> lock(m_decode_mutex);
+
+    while (true) {
+        // Only decode up to m_read_ahead frames past the one the main loop is waiting on
+        m_slot_freed.wait(lock, [this] { 
+            return m_stop_decoding || (m_next_decode < m_frame_count && m_next_decode < m_index + m_read_ahead); 
+        });
+        if (m_stop_decoding) {
+            return;
+        }
+
+        int index = m_next_decode;
+        m_next_decode++;
+
+        // Decoding happens outside of the lock so that multiple frames are decoded at once
+        cv::Mat rgb, depth;
+        lock.unlock();
+        decode_frame(index, rgb, depth);
+        lock.lock();
+
+        DecodedFrame &slot = m_slots[index % m_read_ahead];
+        slot.rgb = rgb;
+        slot.depth = depth;
+        slot.ready = true;
+        m_slot_ready.notify_all();
+    }
+}
+
+PackedCameraStream::PackedCameraStream(const std::string &packed_path) :
+    CameraStream{},
+    m_dataset{packed_path},
+    m_index{0}
+{
+    m_frame_count = m_dataset.get_frame_count();
+
+    if (m_frame_count == 0) {
+        throw std::runtime_error("[PACKED CAMERA]: No frames in packed dataset");
+    }
+
+    set_dataset_resolution(m_dataset.get_dataset_type(), m_width, m_height);
+    m_dataset.prefetch(0);
+
+    std::cout << "[PACKED CAMERA]: Mapped " << m_frame_count << " dataset frames" << std::endl;
+}
+
+std::tuple<cv::Mat, cv::Mat, double> PackedCameraStream::get_stream()
+{
+    // Fault in the next frame while this one is being tracked
+    m_dataset.prefetch(m_index + 1);
+
+    cv::Mat rgb = m_dataset.get_rgb(m_index);
+    cv::Mat depth = m_dataset.get_depth(m_index);
+    double timestamp = m_dataset.get_timestamp(m_index);
     m_index++;
 
     return std::tuple<cv::Mat, cv::Mat, double>(rgb, depth, timestamp);
+}
+
+const PackedDataset& PackedCameraStream::get_dataset() const
+{
+    return m_dataset;
 }
\ No newline at end of file
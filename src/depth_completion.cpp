@@ -16,6 +16,27 @@ const cv::Mat& DepthCompleter::get_depth_image() const
     return m_completed_depth;
 }
 
+void DepthCompleter::set_camera_pose(const Eigen::Matrix4f &camera_pose, bool tracking_ok)
+{
+
+}
+
+void DepthCompleter::set_frame_index(int index)
+{
+
+}
+
+// Implementations have to opt in to running concurrently or out of order
+bool DepthCompleter::is_thread_safe() const
+{
+    return false;
+}
+
+bool DepthCompleter::is_stateful() const
+{
+    return true;
+}
+
 // Implementation definitions
 OfflineDepthCompleter::OfflineDepthCompleter(const std::string &dataset_dir, const std::string &prefix, OfflineDatasetType type) :
     DepthCompleter{},
@@ -49,19 +70,668 @@ OfflineDepthCompleter::OfflineDepthCompleter(const std::string &dataset_dir, con
     std::cout << "[OFFLINE DEPTH COMPLETER]: Read " << m_depth_images.size() << " depth images" << std::endl;
 }
 
-void OfflineDepthCompleter::complete_depth_image(const cv::Mat &incomplete_depth_image)
+void OfflineDepthCompleter::complete_depth_image(const cv::Mat &rgb_image, const cv::Mat &incomplete_depth_image)
+{
+    // Past the end of the dataset, or without a readable depth image, there's
+    // no completed depth, so the frame is skipped
+    if (m_image_idx < 0 || m_image_idx >= m_depth_images.size()) {
+        m_completed_depth.release();
+        return;
+    }
+    const std::string depth_path = m_dataset_dir + "/" + m_depth_images[m_image_idx++];
+    cv::Mat raw_depth = cv::imread(depth_path, cv::IMREAD_UNCHANGED);
+    if (raw_depth.empty()) {
+        std::cout << "[OFFLINE DEPTH COMPLETER]: Could not read " << depth_path << std::endl;
+        m_completed_depth.release();
+        return;
+    }
+
+    // Replace 0 values with a high value (arbitrarily set to 10.0f),
+    // and resample to the resolution of the incoming frame
+    convert_depth(raw_depth, m_completed_depth, incomplete_depth_image.size(), m_scale, 0.0f, 10.0f);
+}
+
+void OfflineDepthCompleter::set_frame_index(int index)
+{
+    m_image_idx = index;
+}
+
+bool OfflineDepthCompleter::is_thread_safe() const
+{
+    return true;
+}
+
+bool OfflineDepthCompleter::is_stateful() const
+{
+    return true;
+}
+
+namespace
+{
+
+// Depths are inverted so that dilation favors closer objects,
+// and empty pixels are left at 0.
+const float MAX_DEPTH = 20.0f;
+const float MIN_VALID_DEPTH = 0.1f;
+const float FAR_DEPTH = 10.0f;
+
+// Rows needed above and below each band: the sum of the radii of every
+// filter applied to it (diamond 5, close 5, full 7, full 31, median 5, blur 5)
+const int BAND_OVERLAP = 2 + 4 + 3 + 15 + 2 + 2;
+const int MIN_BAND_ROWS = 64;
+
+// Converts raw sensor depth into inverted metric depth
+void invert_depth_row(const ushort* src, float* dst, int n, float scale)
+{
+    int i = 0;
+#if CV_SIMD
+    const cv::v_float32 v_scale = cv::vx_setall_f32(scale);
+    const cv::v_float32 v_max = cv::vx_setall_f32(MAX_DEPTH);
+    const cv::v_float32 v_min_valid = cv::vx_setall_f32(MIN_VALID_DEPTH);
+    const cv::v_float32 v_zero = cv::vx_setzero_f32();
+    for (; i <= n - cv::v_float32::nlanes; i += cv::v_float32::nlanes) {
+        cv::v_float32 depth = cv::v_cvt_f32(cv::v_reinterpret_as_s32(cv::vx_load_expand(src + i))) * v_scale;
+        cv::v_store(dst + i, cv::v_select(depth > v_min_valid, v_max - depth, v_zero));
+    }
+#endif
+    for (; i < n; i++) {
+        float depth = src[i] * scale;
+        dst[i] = (depth > MIN_VALID_DEPTH) ? MAX_DEPTH - depth : 0.0f;
+    }
+}
+
+// Fills the empty pixels of dst with src
+void fill_empty_row(const float* src, float* dst, int n)
+{
+    int i = 0;
+#if CV_SIMD
+    const cv::v_float32 v_min_valid = cv::vx_setall_f32(MIN_VALID_DEPTH);
+    for (; i <= n - cv::v_float32::nlanes; i += cv::v_float32::nlanes) {
+        cv::v_float32 value = cv::vx_load(dst + i);
+        cv::v_store(dst + i, cv::v_select(value < v_min_valid, cv::vx_load(src + i), value));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = (dst[i] < MIN_VALID_DEPTH) ? src[i] : dst[i];
+    }
+}
+
+// Replaces the valid pixels of dst with src
+void replace_valid_row(const float* src, float* dst, int n)
+{
+    int i = 0;
+#if CV_SIMD
+    const cv::v_float32 v_min_valid = cv::vx_setall_f32(MIN_VALID_DEPTH);
+    for (; i <= n - cv::v_float32::nlanes; i += cv::v_float32::nlanes) {
+        cv::v_float32 value = cv::vx_load(dst + i);
+        cv::v_store(dst + i, cv::v_select(value > v_min_valid, cv::vx_load(src + i), value));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = (dst[i] > MIN_VALID_DEPTH) ? src[i] : dst[i];
+    }
+}
+
+// Converts inverted depth back to metric depth, where anything still empty is far away
+void restore_depth_row(const float* src, float* dst, int n)
+{
+    int i = 0;
+#if CV_SIMD
+    const cv::v_float32 v_max = cv::vx_setall_f32(MAX_DEPTH);
+    const cv::v_float32 v_min_valid = cv::vx_setall_f32(MIN_VALID_DEPTH);
+    const cv::v_float32 v_far = cv::vx_setall_f32(FAR_DEPTH);
+    for (; i <= n - cv::v_float32::nlanes; i += cv::v_float32::nlanes) {
+        cv::v_float32 value = cv::vx_load(src + i);
+        cv::v_store(dst + i, cv::v_select(value > v_min_valid, v_max - value, v_far));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = (src[i] > MIN_VALID_DEPTH) ? MAX_DEPTH - src[i] : FAR_DEPTH;
+    }
+}
+
+void fill_empty(const cv::Mat &src, cv::Mat &dst)
+{
+    for (int y = 0; y < dst.rows; y++) {
+        fill_empty_row(src.ptr<float>(y), dst.ptr<float>(y), dst.cols);
+    }
+}
+
+void replace_valid(const cv::Mat &src, cv::Mat &dst)
+{
+    for (int y = 0; y < dst.rows; y++) {
+        replace_valid_row(src.ptr<float>(y), dst.ptr<float>(y), dst.cols);
+    }
+}
+
+} // namespace
+
+MorphologicalDepthCompleter::MorphologicalDepthCompleter(OfflineDatasetType type, int num_bands) :
+    DepthCompleter{},
+    m_num_bands{num_bands}
+{
+    switch (type) {
+        case OfflineDatasetType::ETH3D: {
+            m_scale = 1 / 5000.0f;
+            break;
+        }
+        case OfflineDatasetType::SCANNET: {
+            m_scale = 1 / 5000.0f;
+            break;
+        }
+    }
+
+    m_diamond_kernel_5 = (cv::Mat_<uchar>(5, 5) <<
+        0, 0, 1, 0, 0,
+        0, 1, 1, 1, 0,
+        1, 1, 1, 1, 1,
+        0, 1, 1, 1, 0,
+        0, 0, 1, 0, 0);
+    m_full_kernel_5 = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(5, 5));
+    m_full_kernel_7 = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(7, 7));
+    m_full_kernel_31 = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(31, 31));
+
+    std::cout << "[MORPHOLOGICAL DEPTH COMPLETER]: Initialized" << std::endl;
+}
+
+void MorphologicalDepthCompleter::complete_depth_image(const cv::Mat &rgb_image, const cv::Mat &incomplete_depth_image)
+{
+    CV_Assert(incomplete_depth_image.type() == CV_16UC1);
+
+    const int rows = incomplete_depth_image.rows;
+    m_completed_depth.create(rows, incomplete_depth_image.cols, CV_32FC1);
+
+    // Bands have to be tall enough that the overlap doesn't dominate
+    int num_bands = (m_num_bands > 0) ? m_num_bands : cv::getNumThreads();
+    num_bands = std::max(1, std::min(num_bands, rows / MIN_BAND_ROWS));
+    if (m_band_depths.size() != num_bands) {
+        m_band_depths.resize(num_bands);
+        m_band_buffers.resize(num_bands);
+    }
+
+    cv::parallel_for_(cv::Range(0, num_bands), [&](const cv::Range &range) {
+        for (int band = range.start; band < range.end; band++) {
+            complete_band(incomplete_depth_image, band, band * rows / num_bands, (band + 1) * rows / num_bands);
+        }
+    });
+}
+
+bool MorphologicalDepthCompleter::is_thread_safe() const
+{
+    return true;
+}
+
+bool MorphologicalDepthCompleter::is_stateful() const
+{
+    return false;
+}
+
+void MorphologicalDepthCompleter::complete_band(const cv::Mat &incomplete_depth_image, int band, int row_start, int row_end)
+{
+    // Process the band along with the overlapping rows above and below it
+    const int cols = incomplete_depth_image.cols;
+    const int start = std::max(row_start - BAND_OVERLAP, 0);
+    const int end = std::min(row_end + BAND_OVERLAP, incomplete_depth_image.rows);
+
+    cv::Mat &depth = m_band_depths[band];
+    cv::Mat &buffer = m_band_buffers[band];
+    depth.create(end - start, cols, CV_32FC1);
+    buffer.create(end - start, cols, CV_32FC1);
+
+    for (int y = start; y < end; y++) {
+        invert_depth_row(incomplete_depth_image.ptr<ushort>(y), depth.ptr<float>(y - start), cols, m_scale);
+    }
+
+    // Dilate and close small holes
+    cv::dilate(depth, depth, m_diamond_kernel_5);
+    cv::morphologyEx(depth, depth, cv::MORPH_CLOSE, m_full_kernel_5);
+
+    // Fill the remaining small, then large holes
+    cv::dilate(depth, buffer, m_full_kernel_7);
+    fill_empty(buffer, depth);
+    cv::dilate(depth, buffer, m_full_kernel_31);
+    fill_empty(buffer, depth);
+
+    // Smooth out the result without spreading into empty pixels
+    cv::medianBlur(depth, buffer, 5);
+    replace_valid(buffer, depth);
+    cv::GaussianBlur(depth, buffer, cv::Size(5, 5), 0);
+    replace_valid(buffer, depth);
+
+    // Only the rows that belong to this band are written out
+    for (int y = row_start; y < row_end; y++) {
+        restore_depth_row(depth.ptr<float>(y - start), m_completed_depth.ptr<float>(y), cols);
+    }
+}
+
+GuidedDepthCompleter::GuidedDepthCompleter(OfflineDatasetType type, float sigma_spatial, float sigma_range, int num_iterations) :
+    DepthCompleter{},
+    m_sigma_spatial{sigma_spatial},
+    m_sigma_range{sigma_range},
+    m_num_iterations{num_iterations}
+{
+    switch (type) {
+        case OfflineDatasetType::ETH3D: {
+            m_scale = 1 / 5000.0f;
+            break;
+        }
+        case OfflineDatasetType::SCANNET: {
+            m_scale = 1 / 5000.0f;
+            break;
+        }
+    }
+
+    std::cout << "[GUIDED DEPTH COMPLETER]: Initialized" << std::endl;
+}
+
+void GuidedDepthCompleter::complete_depth_image(const cv::Mat &rgb_image, const cv::Mat &incomplete_depth_image)
+{
+    CV_Assert(rgb_image.type() == CV_8UC3 && incomplete_depth_image.type() == CV_16UC1);
+    CV_Assert(rgb_image.size() == incomplete_depth_image.size());
+
+    const int rows = incomplete_depth_image.rows, cols = incomplete_depth_image.cols;
+    m_weighted_depth.create(rows, cols, CV_32FC1);
+    m_confidence.create(rows, cols, CV_32FC1);
+    m_completed_depth.create(rows, cols, CV_32FC1);
+
+    // Normalized convolution filters the measured depths and where they were measured
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+        for (int y = range.start; y < range.end; y++) {
+            float* weighted = m_weighted_depth.ptr<float>(y);
+            float* confidence = m_confidence.ptr<float>(y);
+            convert_depth_row(incomplete_depth_image.ptr<ushort>(y), weighted, cols, m_scale, MIN_VALID_DEPTH, 0.0f);
+            for (int x = 0; x < cols; x++) {
+                confidence[x] = (weighted[x] > 0.0f) ? 1.0f : 0.0f;
+            }
+        }
+    });
+
+    compute_derivatives(rgb_image);
+
+    // Each iteration alternates horizontal and vertical passes with a shrinking filter size
+    for (int i = 0; i < m_num_iterations; i++) {
+        float sigma = m_sigma_spatial * std::sqrt(3.0f) * std::pow(2.0f, m_num_iterations - i - 1) / 
+                      std::sqrt(std::pow(4.0f, m_num_iterations) - 1.0f);
+        float log_a = -std::sqrt(2.0f) / sigma;
+
+        // The weight between neighbors is a^d, where d is the domain transform distance
+        m_horizontal_derivative.convertTo(m_horizontal_weights, CV_32F, log_a);
+        cv::exp(m_horizontal_weights, m_horizontal_weights);
+        filter_horizontal(m_horizontal_weights);
+
+        m_vertical_derivative.convertTo(m_vertical_weights, CV_32F, log_a);
+        cv::exp(m_vertical_weights, m_vertical_weights);
+        filter_vertical(m_vertical_weights);
+    }
+
+    // Measured depths are kept, and holes the filter couldn't reach are far away
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+        for (int y = range.start; y < range.end; y++) {
+            const float* weighted = m_weighted_depth.ptr<float>(y);
+            const float* confidence = m_confidence.ptr<float>(y);
+            float* completed = m_completed_depth.ptr<float>(y);
+            convert_depth_row(incomplete_depth_image.ptr<ushort>(y), completed, cols, m_scale, MIN_VALID_DEPTH, 0.0f);
+            for (int x = 0; x < cols; x++) {
+                if (completed[x] > 0.0f) {
+                    continue;
+                } else if (confidence[x] > 1e-4f) {
+                    completed[x] = weighted[x] / confidence[x];
+                } else {
+                    completed[x] = FAR_DEPTH;
+                }
+            }
+        }
+    });
+}
+
+bool GuidedDepthCompleter::is_thread_safe() const
+{
+    return true;
+}
+
+bool GuidedDepthCompleter::is_stateful() const
+{
+    return false;
+}
+
+void GuidedDepthCompleter::compute_derivatives(const cv::Mat &rgb_image)
+{
+    const int rows = rgb_image.rows, cols = rgb_image.cols;
+    const float ratio = m_sigma_spatial / (m_sigma_range * 255.0f);
+    m_horizontal_derivative.create(rows, cols, CV_32FC1);
+    m_vertical_derivative.create(rows, cols, CV_32FC1);
+
+    // The derivative at a pixel describes the distance to its left (or upper) neighbor
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+        for (int y = range.start; y < range.end; y++) {
+            const uchar* curr = rgb_image.ptr<uchar>(y);
+            const uchar* prev = rgb_image.ptr<uchar>(std::max(y - 1, 0));
+            float* horizontal = m_horizontal_derivative.ptr<float>(y);
+            float* vertical = m_vertical_derivative.ptr<float>(y);
+
+            horizontal[0] = 1.0f;
+            for (int x = 1; x < cols; x++) {
+                int diff = std::abs(curr[3 * x] - curr[3 * x - 3]) + 
+                           std::abs(curr[3 * x + 1] - curr[3 * x - 2]) + 
+                           std::abs(curr[3 * x + 2] - curr[3 * x - 1]);
+                horizontal[x] = 1.0f + ratio * diff;
+            }
+
+            for (int x = 0; x < cols; x++) {
+                int diff = std::abs(curr[3 * x] - prev[3 * x]) + 
+                           std::abs(curr[3 * x + 1] - prev[3 * x + 1]) + 
+                           std::abs(curr[3 * x + 2] - prev[3 * x + 2]);
+                vertical[x] = 1.0f + ratio * diff;
+            }
+        }
+    });
+}
+
+void GuidedDepthCompleter::filter_horizontal(const cv::Mat &weights)
+{
+    const int cols = weights.cols;
+
+    // Rows are independent, and each one is filtered left to right and then back
+    cv::parallel_for_(cv::Range(0, weights.rows), [&](const cv::Range &range) {
+        for (int y = range.start; y < range.end; y++) {
+            const float* w = weights.ptr<float>(y);
+            float* depth = m_weighted_depth.ptr<float>(y);
+            float* confidence = m_confidence.ptr<float>(y);
+
+            for (int x = 1; x < cols; x++) {
+                depth[x] += w[x] * (depth[x - 1] - depth[x]);
+                confidence[x] += w[x] * (confidence[x - 1] - confidence[x]);
+            }
+            for (int x = cols - 2; x >= 0; x--) {
+                depth[x] += w[x + 1] * (depth[x + 1] - depth[x]);
+                confidence[x] += w[x + 1] * (confidence[x + 1] - confidence[x]);
+            }
+        }
+    });
+}
+
+void GuidedDepthCompleter::filter_vertical(const cv::Mat &weights)
+{
+    const int rows = weights.rows, cols = weights.cols;
+    const int strip_width = 64;
+
+    // Columns are split into strips, and each strip sweeps down and back up
+    // a whole row at a time so that the inner loop runs over contiguous memory.
+    cv::parallel_for_(cv::Range(0, (cols + strip_width - 1) / strip_width), [&](const cv::Range &range) {
+        for (int strip = range.start; strip < range.end; strip++) {
+            const int x_start = strip * strip_width;
+            const int x_end = std::min(x_start + strip_width, cols);
+
+            for (int y = 1; y < rows; y++) {
+                const float* w = weights.ptr<float>(y);
+                const float* prev_depth = m_weighted_depth.ptr<float>(y - 1);
+                const float* prev_confidence = m_confidence.ptr<float>(y - 1);
+                float* depth = m_weighted_depth.ptr<float>(y);
+                float* confidence = m_confidence.ptr<float>(y);
+                for (int x = x_start; x < x_end; x++) {
+                    depth[x] += w[x] * (prev_depth[x] - depth[x]);
+                    confidence[x] += w[x] * (prev_confidence[x] - confidence[x]);
+                }
+            }
+
+            for (int y = rows - 2; y >= 0; y--) {
+                const float* w = weights.ptr<float>(y + 1);
+                const float* next_depth = m_weighted_depth.ptr<float>(y + 1);
+                const float* next_confidence = m_confidence.ptr<float>(y + 1);
+                float* depth = m_weighted_depth.ptr<float>(y);
+                float* confidence = m_confidence.ptr<float>(y);
+                for (int x = x_start; x < x_end; x++) {
+                    depth[x] += w[x] * (next_depth[x] - depth[x]);
+                    confidence[x] += w[x] * (next_confidence[x] - confidence[x]);
+                }
+            }
+        }
+    });
+}
+
+namespace
 {
-    // This implementation requires 2 frames to initialize
-    cv::Mat raw_depth = cv::imread(m_dataset_dir + "/" + m_depth_images[m_image_idx], cv::IMREAD_UNCHANGED);
-    cv::Mat buffer = raw_depth;
-    raw_depth.convertTo(buffer, CV_32F);
 
-    // Replace 0 values with a high value (arbitrarily set to 10.0f)
-    cv::Mat mask = (buffer == 0);
-    cv::Mat mask_buffer = mask;
-    mask.convertTo(mask_buffer, CV_32F);
+// Reprojected depths are checked against the raw depth in tiles. Tiles are
+// completed again with enough margin for the morphological filters.
+const int TILE_SIZE = 16;
+const int TILE_MARGIN = BAND_OVERLAP;
+const float INCONSISTENT_DEPTH = 0.05f;
+const float MAX_INCONSISTENT_FRACTION = 0.1f;
 
-    m_completed_depth = 10.0f * mask_buffer + buffer * m_scale;
+} // namespace
 
-    m_image_idx++;
+TemporalDepthCompleter::TemporalDepthCompleter(DepthCompleter &completer, OfflineDatasetType type, const std::string &camera_settings, int refresh_interval) :
+    DepthCompleter{},
+    m_completer{completer},
+    m_refresh_interval{refresh_interval},
+    m_tracking_ok{false},
+    m_has_previous_pose{false},
+    m_frames_since_refresh{0},
+    m_recomputed_sum{0.0},
+    m_frame_count{0}
+{
+    switch (type) {
+        case OfflineDatasetType::ETH3D: {
+            m_scale = 1 / 5000.0f;
+            break;
+        }
+        case OfflineDatasetType::SCANNET: {
+            m_scale = 1 / 5000.0f;
+            break;
+        }
+    }
+
+    cv::FileStorage settings(camera_settings, cv::FileStorage::READ);
+    m_fx = settings["Camera1.fx"];
+    m_fy = settings["Camera1.fy"];
+    m_cx = settings["Camera1.cx"];
+    m_cy = settings["Camera1.cy"];
+
+    std::cout << "[TEMPORAL DEPTH COMPLETER]: Initialized" << std::endl;
+}
+
+TemporalDepthCompleter::~TemporalDepthCompleter()
+{
+    std::cout << "[TEMPORAL DEPTH COMPLETER]: Recomputed " << 100.0 * get_recomputed_fraction() << "% of pixels on average" << std::endl;
+}
+
+void TemporalDepthCompleter::complete_depth_image(const cv::Mat &rgb_image, const cv::Mat &incomplete_depth_image)
+{
+    bool can_reuse = m_tracking_ok && m_has_previous_pose && 
+                     m_previous_depth.size() == incomplete_depth_image.size() && 
+                     m_frames_since_refresh < m_refresh_interval;
+    if (!can_reuse) {
+        complete_all(rgb_image, incomplete_depth_image);
+        return;
+    }
+
+    reproject();
+
+    const int rows = incomplete_depth_image.rows, cols = incomplete_depth_image.cols;
+    const int tiles_x = (cols + TILE_SIZE - 1) / TILE_SIZE;
+    const int tiles_y = (rows + TILE_SIZE - 1) / TILE_SIZE;
+    m_fused_depth.create(rows, cols, CV_16UC1);
+    m_recompute.create(rows, cols, CV_8UC1);
+    m_completed_depth.create(rows, cols, CV_32FC1);
+    m_dirty_tiles.assign(tiles_x * tiles_y, 0);
+
+    // Classify every pixel: measured pixels are kept, holes take the reprojected
+    // depth unless nothing landed there or the tile disagrees with the raw depth.
+    cv::parallel_for_(cv::Range(0, tiles_y), [&](const cv::Range &range) {
+        for (int ty = range.start; ty < range.end; ty++) {
+            const int y_start = ty * TILE_SIZE, y_end = std::min(y_start + TILE_SIZE, rows);
+            for (int tx = 0; tx < tiles_x; tx++) {
+                const int x_start = tx * TILE_SIZE, x_end = std::min(x_start + TILE_SIZE, cols);
+
+                int compared = 0, inconsistent = 0;
+                for (int y = y_start; y < y_end; y++) {
+                    const ushort* raw = incomplete_depth_image.ptr<ushort>(y);
+                    const float* reprojected = m_reprojected.ptr<float>(y);
+                    for (int x = x_start; x < x_end; x++) {
+                        float depth = raw[x] * m_scale;
+                        if (depth > MIN_VALID_DEPTH && reprojected[x] > 0.0f) {
+                            compared++;
+                            inconsistent += (std::abs(depth - reprojected[x]) > INCONSISTENT_DEPTH * depth);
+                        }
+                    }
+                }
+                bool reuse = (inconsistent <= MAX_INCONSISTENT_FRACTION * compared);
+
+                for (int y = y_start; y < y_end; y++) {
+                    const ushort* raw = incomplete_depth_image.ptr<ushort>(y);
+                    const float* reprojected = m_reprojected.ptr<float>(y);
+                    ushort* fused = m_fused_depth.ptr<ushort>(y);
+                    uchar* recompute = m_recompute.ptr<uchar>(y);
+                    float* completed = m_completed_depth.ptr<float>(y);
+                    for (int x = x_start; x < x_end; x++) {
+                        float depth = raw[x] * m_scale;
+                        if (depth > MIN_VALID_DEPTH) {
+                            fused[x] = raw[x];
+                            recompute[x] = 0;
+                            completed[x] = depth;
+                        } else if (reuse && reprojected[x] > 0.0f) {
+                            fused[x] = cv::saturate_cast<ushort>(reprojected[x] / m_scale);
+                            recompute[x] = 0;
+                            completed[x] = reprojected[x];
+                        } else {
+                            fused[x] = 0;
+                            recompute[x] = 1;
+                            m_dirty_tiles[ty * tiles_x + tx] = 1;
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    // Each row of tiles completes the span between its first and last dirty tile
+    int recomputed = 0;
+    for (int ty = 0; ty < tiles_y; ty++) {
+        int first = tiles_x, last = -1;
+        for (int tx = 0; tx < tiles_x; tx++) {
+            if (m_dirty_tiles[ty * tiles_x + tx]) {
+                first = std::min(first, tx);
+                last = tx;
+            }
+        }
+        if (last < 0) {
+            continue;
+        }
+
+        const int y_start = ty * TILE_SIZE, y_end = std::min(y_start + TILE_SIZE, rows);
+        const int x_start = first * TILE_SIZE, x_end = std::min((last + 1) * TILE_SIZE, cols);
+        const cv::Rect region(cv::Point(std::max(x_start - TILE_MARGIN, 0), std::max(y_start - TILE_MARGIN, 0)), 
+                              cv::Point(std::min(x_end + TILE_MARGIN, cols), std::min(y_end + TILE_MARGIN, rows)));
+        m_completer.complete_depth_image(rgb_image(region), m_fused_depth(region));
+        const cv::Mat &region_depth = m_completer.get_depth_image();
+
+        for (int y = y_start; y < y_end; y++) {
+            const uchar* recompute = m_recompute.ptr<uchar>(y);
+            const float* filled = region_depth.ptr<float>(y - region.y);
+            float* completed = m_completed_depth.ptr<float>(y);
+            for (int x = x_start; x < x_end; x++) {
+                if (recompute[x]) {
+                    completed[x] = filled[x - region.x];
+                    recomputed++;
+                }
+            }
+        }
+    }
+
+    m_recomputed_sum += static_cast<double>(recomputed) / (rows * cols);
+    m_frame_count++;
+    m_frames_since_refresh++;
+    m_completed_depth.copyTo(m_previous_depth);
+    m_previous_pose = m_camera_pose;
+}
+
+void TemporalDepthCompleter::set_camera_pose(const Eigen::Matrix4f &camera_pose, bool tracking_ok)
+{
+    m_camera_pose = camera_pose;
+    m_tracking_ok = tracking_ok;
+}
+
+void TemporalDepthCompleter::set_frame_index(int index)
+{
+    m_completer.set_frame_index(index);
+}
+
+bool TemporalDepthCompleter::is_thread_safe() const
+{
+    return m_completer.is_thread_safe();
+}
+
+bool TemporalDepthCompleter::is_stateful() const
+{
+    return true;
+}
+
+double TemporalDepthCompleter::get_recomputed_fraction() const
+{
+    return (m_frame_count > 0) ? m_recomputed_sum / m_frame_count : 0.0;
+}
+
+void TemporalDepthCompleter::complete_all(const cv::Mat &rgb_image, const cv::Mat &incomplete_depth_image)
+{
+    m_completer.complete_depth_image(rgb_image, incomplete_depth_image);
+    m_completer.get_depth_image().copyTo(m_completed_depth);
+
+    m_recomputed_sum += 1.0;
+    m_frame_count++;
+    m_frames_since_refresh = 0;
+
+    // Without a pose, the next frame has nothing to reproject from
+    if (m_tracking_ok) {
+        m_completed_depth.copyTo(m_previous_depth);
+        m_previous_pose = m_camera_pose;
+        m_has_previous_pose = true;
+    } else {
+        m_has_previous_pose = false;
+    }
+}
+
+void TemporalDepthCompleter::reproject()
+{
+    const int rows = m_previous_depth.rows, cols = m_previous_depth.cols;
+    m_reprojected.create(rows, cols, CV_32FC1);
+    m_reprojected.setTo(0.0f);
+
+    // Transform from the previous camera to the current one
+    const Eigen::Matrix4f relative = m_camera_pose * inverse_pose(m_previous_pose);
+    const float r00 = relative(0, 0), r01 = relative(0, 1), r02 = relative(0, 2), t0 = relative(0, 3);
+    const float r10 = relative(1, 0), r11 = relative(1, 1), r12 = relative(1, 2), t1 = relative(1, 3);
+    const float r20 = relative(2, 0), r21 = relative(2, 1), r22 = relative(2, 2), t2 = relative(2, 3);
+
+    // Every previous pixel is splatted onto a 2x2 footprint, keeping the closest
+    // depth, so that small changes in scale don't leave cracks between pixels.
+    for (int v = 0; v < rows; v++) {
+        const float* depth = m_previous_depth.ptr<float>(v);
+        const float ray_y = (v - m_cy) / m_fy;
+        for (int u = 0; u < cols; u++) {
+            const float d = depth[u];
+            if (d <= MIN_VALID_DEPTH) {
+                continue;
+            }
+
+            const float x = (u - m_cx) / m_fx * d, y = ray_y * d;
+            const float z_new = r20 * x + r21 * y + r22 * d + t2;
+            if (z_new <= MIN_VALID_DEPTH) {
+                continue;
+            }
+            const float x_new = r00 * x + r01 * y + r02 * d + t0;
+            const float y_new = r10 * x + r11 * y + r12 * d + t1;
+            const int u_new = static_cast<int>(std::floor(m_fx * x_new / z_new + m_cx));
+            const int v_new = static_cast<int>(std::floor(m_fy * y_new / z_new + m_cy));
+
+            for (int j = std::max(v_new, 0); j <= std::min(v_new + 1, rows - 1); j++) {
+                float* reprojected = m_reprojected.ptr<float>(j);
+                for (int i = std::max(u_new, 0); i <= std::min(u_new + 1, cols - 1); i++) {
+                    if (reprojected[i] == 0.0f || z_new < reprojected[i]) {
+                        reprojected[i] = z_new;
+                    }
+                }
+            }
+        }
+    }
 }
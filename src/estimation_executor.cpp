@@ -0,0 +1,74 @@
+#include "estimation_executor.h"
+
+EstimationExecutor::EstimationExecutor(ThreadPool &pool, LightEstimator &light_estimator, DepthCompleter &depth_completer) :
+    m_pool{pool},
+    m_light_estimator{light_estimator},
+    m_depth_completer{depth_completer}
+{
+    bool concurrent = (m_pool.get_thread_count() > 0) && 
+                      (m_light_estimator.is_thread_safe() || m_depth_completer.is_thread_safe());
+    std::cout << "[ESTIMATION]: Light estimation and depth completion run " 
+              << (concurrent ? "concurrently" : "sequentially") << std::endl;
+}
+
+void EstimationExecutor::set_camera_pose(const Eigen::Matrix4f &camera_pose, bool tracking_ok)
+{
+    m_depth_completer.set_camera_pose(camera_pose, tracking_ok);
+}
+
+void EstimationExecutor::set_frame_index(int index)
+{
+    m_depth_completer.set_frame_index(index);
+}
+
+void EstimationExecutor::run(const cv::Mat &rgb_image, const cv::Mat &depth_image)
+{
+    std::function<void()> estimate_lights = [&] {
+        PROFILE_SCOPE("estimate_lights");
+        m_light_estimator.estimate_lights(rgb_image, depth_image);
+    };
+    std::function<void()> complete_depth = [&] {
+        PROFILE_SCOPE("complete_depth_image");
+        m_depth_completer.complete_depth_image(rgb_image, depth_image);
+    };
+
+    // Offload whichever implementation is allowed to run on another thread,
+    // and do the other one on this thread in the meantime.
+    std::future<void> offloaded;
+    std::function<void()> local;
+    if (m_depth_completer.is_thread_safe()) {
+        offloaded = m_pool.submit(complete_depth);
+        local = estimate_lights;
+    } else if (m_light_estimator.is_thread_safe()) {
+        offloaded = m_pool.submit(estimate_lights);
+        local = complete_depth;
+    } else {
+        estimate_lights();
+        complete_depth();
+        return;
+    }
+
+    // The offloaded task references the images, so it always has to finish before returning
+    try {
+        local();
+    } catch (...) {
+        offloaded.wait();
+        throw;
+    }
+    offloaded.get();
+}
+
+const std::vector<Light>& EstimationExecutor::get_lights() const
+{
+    return m_light_estimator.get_lights();
+}
+
+const cv::Mat& EstimationExecutor::get_depth_image() const
+{
+    return m_depth_completer.get_depth_image();
+}
+
+bool EstimationExecutor::is_stateful() const
+{
+    return m_light_estimator.is_stateful() || m_depth_completer.is_stateful();
+}
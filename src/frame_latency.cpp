@@ -0,0 +1,155 @@
+#include "frame_latency.h"
+
+namespace
+{
+
+double milliseconds_between(int64_t start_ns, int64_t end_ns)
+{
+    return (end_ns - start_ns) / 1.0e6;
+}
+
+} // namespace
+
+LatencyMonitor::LatencyMonitor() :
+    m_history(HISTORY_SIZE),
+    m_presented{0},
+    m_summary_bins(NUM_SUMMARY_BINS, 0),
+    m_first_capture_ns{-1},
+    m_last_index{-1},
+    m_pending_duplicates{0},
+    m_total_dropped{0},
+    m_total_duplicates{0}
+{
+
+}
+
+void LatencyMonitor::record_present(const Frame &frame, bool new_frame, int64_t present_ns)
+{
+    if (!new_frame) {
+        m_pending_duplicates++;
+        m_total_duplicates++;
+        return;
+    }
+
+    if (m_first_capture_ns < 0) {
+        m_first_capture_ns = frame.capture_ns;
+    }
+
+    // Frames are indexed as they're captured, so any gap was dropped somewhere in between
+    int dropped = (m_last_index >= 0) ? std::max(0, frame.index - m_last_index - 1) : 0;
+    m_last_index = frame.index;
+    m_total_dropped += dropped;
+
+    FrameLatency latency;
+    latency.index = frame.index;
+    latency.capture_ms = milliseconds_between(m_first_capture_ns, frame.capture_ns);
+    latency.tracked_ms = milliseconds_between(frame.capture_ns, frame.tracked_ns);
+    latency.completed_ms = milliseconds_between(frame.capture_ns, frame.completed_ns);
+    latency.submitted_ms = milliseconds_between(frame.capture_ns, frame.submitted_ns);
+    latency.presented_ms = milliseconds_between(frame.capture_ns, present_ns);
+    latency.pose_age_ms = milliseconds_between(frame.tracked_ns, present_ns);
+    latency.depth_age_ms = milliseconds_between(frame.completed_ns, present_ns);
+    latency.dropped = dropped;
+    latency.duplicates = m_pending_duplicates;
+    m_history[m_presented % HISTORY_SIZE] = latency;
+    m_presented++;
+    m_summary_bins[std::min(NUM_SUMMARY_BINS - 1, std::max(0, static_cast<int>(latency.presented_ms / SUMMARY_BIN_MS)))]++;
+
+    if (m_csv.is_open()) {
+        m_csv << latency.index << "," << latency.capture_ms << "," << latency.tracked_ms << ","
+              << latency.completed_ms << "," << latency.submitted_ms << "," << latency.presented_ms << ","
+              << latency.pose_age_ms << "," << latency.depth_age_ms << "," << latency.dropped << "," << latency.duplicates << "\n";
+    }
+
+    m_pending_duplicates = 0;
+}
+
+void LatencyMonitor::draw_ui() const
+{
+    draw_histogram("End-to-end", &FrameLatency::presented_ms);
+    draw_histogram("Pose age", &FrameLatency::pose_age_ms);
+    draw_histogram("Depth age", &FrameLatency::depth_age_ms);
+    ImGui::Text("Presented %zu frames, dropped %ld, duplicated %ld", m_presented, m_total_dropped, m_total_duplicates);
+}
+
+void LatencyMonitor::draw_histogram(const char* label, double FrameLatency::*metric) const
+{
+    const size_t count = std::min(m_presented, static_cast<size_t>(HISTORY_SIZE));
+    float bins[NUM_BINS] = {};
+    float max_bin = 1.0f;
+    for (size_t i = 0; i < count; i++) {
+        int bin = std::min(NUM_BINS - 1, std::max(0, static_cast<int>(m_history[i].*metric / BIN_MS)));
+        bins[bin] += 1.0f;
+        max_bin = std::max(max_bin, bins[bin]);
+    }
+
+    // The overlay shows the recent median, and the bins run from 0 to 200 ms
+    char overlay[64];
+    std::snprintf(overlay, sizeof(overlay), "p50 %.1f ms, p95 %.1f ms", percentile(metric, 0.50), percentile(metric, 0.95));
+    ImGui::PlotHistogram(label, bins, NUM_BINS, 0, overlay, 0.0f, max_bin, ImVec2(0.0f, 60.0f));
+}
+
+double LatencyMonitor::percentile(double FrameLatency::*metric, double p) const
+{
+    // The order of the frames in the ring doesn't matter here
+    const size_t count = std::min(m_presented, static_cast<size_t>(HISTORY_SIZE));
+    if (count == 0) {
+        return 0.0;
+    }
+
+    std::vector<double> values;
+    values.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        values.push_back(m_history[i].*metric);
+    }
+    size_t nth = std::min(count - 1, static_cast<size_t>(p * count));
+    std::nth_element(values.begin(), values.begin() + nth, values.end());
+    return values[nth];
+}
+
+double LatencyMonitor::summary_percentile(double p) const
+{
+    if (m_presented == 0) {
+        return 0.0;
+    }
+
+    // Upper edge of the bin the percentile falls in
+    const long nth = std::min(static_cast<long>(m_presented) - 1, static_cast<long>(p * m_presented));
+    long seen = 0;
+    for (int bin = 0; bin < NUM_SUMMARY_BINS; bin++) {
+        seen += m_summary_bins[bin];
+        if (seen > nth) {
+            return (bin + 1) * SUMMARY_BIN_MS;
+        }
+    }
+    return NUM_SUMMARY_BINS * SUMMARY_BIN_MS;
+}
+
+bool LatencyMonitor::open_csv(const std::string &filepath)
+{
+    m_csv.open(filepath);
+    if (!m_csv.is_open()) {
+        std::cerr << "[LATENCY]: Can't open " << filepath << std::endl;
+        return false;
+    }
+    m_csv_path = filepath;
+
+    m_csv << "index,capture_ms,tracked_ms,completed_ms,submitted_ms,presented_ms,pose_age_ms,depth_age_ms,dropped,duplicates\n";
+    return true;
+}
+
+void LatencyMonitor::close_csv()
+{
+    if (!m_csv.is_open()) {
+        return;
+    }
+    m_csv.close();
+    std::cout << "[LATENCY]: Wrote " << m_presented << " frames to " << m_csv_path << std::endl;
+}
+
+void LatencyMonitor::print_summary() const
+{
+    std::cout << "[LATENCY]: End-to-end p50 " << summary_percentile(0.50)
+              << " ms, p95 " << summary_percentile(0.95) << " ms over " << m_presented << " frames, "
+              << m_total_dropped << " dropped, " << m_total_duplicates << " duplicated" << std::endl;
+}
@@ -0,0 +1,340 @@
+#include "frame_pipeline.h"
+
+namespace
+{
+
+double milliseconds_since(const std::chrono::time_point<std::chrono::steady_clock> &start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void print_stage(const std::string &name, const StageStats &stats)
+{
+    double average = (stats.frames > 0) ? stats.busy_ms / stats.frames : 0.0;
+    std::cout << "[PIPELINE]: " << name << " stage processed " << stats.frames << " frames, " 
+              << average << " ms/frame" << std::endl;
+}
+
+void print_queue(const std::string &name, const QueueStats &stats)
+{
+    std::cout << "[PIPELINE]: " << name << " queue dropped " << stats.dropped << " of " 
+              << stats.pushed + stats.dropped << " frames (max depth " << stats.max_depth << ")" << std::endl;
+}
+
+} // namespace
+
+FramePipeline::FramePipeline(const PipelineSettings &settings,
+                             CameraStream &camera,
+                             ORB_SLAM3::System* slam,
+                             EstimationExecutor &estimation,
+                             Renderer &renderer,
+                             FramePool &frame_pool) :
+    m_settings{settings},
+    m_camera{camera},
+    m_slam{slam},
+    m_estimation{estimation},
+    m_renderer{renderer},
+    m_frame_pool{frame_pool},
+    m_tracking_queue{static_cast<size_t>(settings.queue_capacity), pre_estimation_policy(settings, estimation)},
+    m_estimation_queue{static_cast<size_t>(settings.queue_capacity), pre_estimation_policy(settings, estimation)},
+    m_submit_queue{static_cast<size_t>(settings.queue_capacity), settings.drop_policy},
+    m_record_queue{static_cast<size_t>(settings.queue_capacity), settings.drop_policy},
+    m_recording{nullptr},
+    m_trace_writer{nullptr},
+    m_trace_reader{nullptr},
+    m_io_stats{0, 0.0},
+    m_tracking_stats{0, 0.0},
+    m_estimation_stats{0, 0.0},
+    m_submit_stats{0, 0.0},
+    m_record_stats{0, 0.0},
+    m_late_frames{0}
+{
+
+}
+
+void FramePipeline::set_submit_callback(const std::function<void(int)> &on_submit)
+{
+    m_on_submit = on_submit;
+}
+
+void FramePipeline::set_recording_sink(RecordingSink* recording)
+{
+    m_recording = recording;
+}
+
+void FramePipeline::set_trace_writer(SlamTraceWriter* trace_writer)
+{
+    m_trace_writer = trace_writer;
+}
+
+void FramePipeline::set_trace_reader(SlamTraceReader* trace_reader)
+{
+    m_trace_reader = trace_reader;
+}
+
+void FramePipeline::run()
+{
+    m_threads.push_back(std::thread(&FramePipeline::run_io, this));
+    m_threads.push_back(std::thread(&FramePipeline::run_tracking, this));
+    m_threads.push_back(std::thread(&FramePipeline::run_estimation, this));
+    m_threads.push_back(std::thread(&FramePipeline::run_submit, this));
+    if (m_recording && !m_settings.headless) {
+        m_threads.push_back(std::thread(&FramePipeline::run_record, this));
+    } else {
+        m_record_queue.close();
+    }
+
+    // Each stage closes the queue after it once its input runs dry
+    for (int i = 0; i < m_threads.size(); i++) {
+        m_threads[i].join();
+    }
+    m_threads.clear();
+
+    print_stats();
+}
+
+void FramePipeline::run_io()
+{
+    set_profile_thread_name("I/O");
+    const int num_frames = m_camera.get_frame_count();
+    const cv::Size size(m_settings.width, m_settings.height);
+    std::chrono::time_point<std::chrono::steady_clock> deadline = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < num_frames; i++) {
+        // The camera is paced against deadlines, so the time spent
+        // reading a frame isn't added on top of the frame period.
+        if (!m_settings.headless) {
+            std::this_thread::sleep_until(deadline);
+        }
+        const std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+
+        Frame* frame = m_frame_pool.acquire();
+        std::tuple<cv::Mat, cv::Mat, double> stream;
+        {
+            PROFILE_SCOPE("get_stream");
+            stream = m_camera.get_stream();
+        }
+        frame->capture_ns = latency_clock_ns();
+        frame->index = i;
+        frame->timestamp = std::get<2>(stream);
+        {
+            PROFILE_SCOPE("resize");
+            cv::resize(std::get<0>(stream), frame->rgb_image, size);
+            cv::resize(std::get<1>(stream), frame->depth_image, size);
+        }
+
+        m_io_stats.frames++;
+        m_io_stats.busy_ms += milliseconds_since(start);
+        forward(m_tracking_queue, frame);
+
+        if (m_settings.headless) {
+            continue;
+        }
+
+        // If the camera fell more than a whole period behind, the schedule restarts
+        // from now instead of trying to catch up with a burst of frames.
+        deadline += m_settings.frame_period;
+        const std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
+        if (now > deadline + m_settings.frame_period) {
+            m_late_frames++;
+            deadline = now;
+        }
+    }
+
+    m_tracking_queue.close();
+}
+
+void FramePipeline::run_tracking()
+{
+    set_profile_thread_name("Tracking");
+    Frame* frame;
+    while (m_tracking_queue.pop(frame)) {
+        const std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+
+        // When replaying, frames that weren't tracked in the recorded run are dropped too
+        if (m_trace_reader) {
+            if (!m_trace_reader->read(*frame)) {
+                m_frame_pool.release(frame);
+                continue;
+            }
+        } else {
+            track(*frame);
+            if (m_trace_writer) {
+                m_trace_writer->write(*frame);
+            }
+        }
+        frame->tracked_ns = latency_clock_ns();
+
+        m_tracking_stats.frames++;
+        m_tracking_stats.busy_ms += milliseconds_since(start);
+        forward(m_estimation_queue, frame);
+    }
+
+    m_estimation_queue.close();
+}
+
+void FramePipeline::track(Frame &frame)
+{
+    // We always want to update the pose whenever we update the image
+    {
+        PROFILE_SCOPE("TrackRGBD");
+        frame.camera_pose = m_slam->TrackRGBD(frame.rgb_image, frame.depth_image, frame.timestamp).matrix();
+    }
+    frame.tracking_state = m_slam->GetTrackingState();
+
+    // ORB-SLAM3 hands out copies of its tracking results, which are copied into the pooled vectors
+    const std::vector<ORB_SLAM3::MapPoint*> map_points = m_slam->GetTrackedMapPoints();
+    const std::vector<cv::KeyPoint> key_points = m_slam->GetTrackedKeyPointsUn();
+    frame.key_points.assign(key_points.begin(), key_points.end());
+    frame.tracked_points.resize(map_points.size());
+    for (int i = 0; i < map_points.size(); i++) {
+        ORB_SLAM3::MapPoint* map_point = map_points[i];
+        TrackedPoint &point = frame.tracked_points[i];
+        if (map_point) {
+            const Eigen::Vector3f position = map_point->GetWorldPos();
+            point.id = map_point->mnId;
+            point.position = cv::Point3f(position(0), position(1), position(2));
+            point.observations = map_point->Observations();
+            point.bad = map_point->isBad();
+        } else {
+            point.id = -1;
+            point.position = cv::Point3f(0.0f, 0.0f, 0.0f);
+            point.observations = 0;
+            point.bad = true;
+        }
+    }
+}
+
+void FramePipeline::run_estimation()
+{
+    set_profile_thread_name("Estimation");
+    const double period_ms = std::chrono::duration<double, std::milli>(m_settings.frame_period).count();
+
+    Frame* frame;
+    while (m_estimation_queue.pop(frame)) {
+        const std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+
+        // Estimate lights and complete depth at the same time
+        {
+            PROFILE_SCOPE("set_camera_pose");
+            m_estimation.set_camera_pose(frame->camera_pose, frame->tracking_state == ORB_SLAM3::Tracking::OK);
+            m_estimation.set_frame_index(frame->index);
+        }
+        m_estimation.run(frame->rgb_image, frame->depth_image);
+        frame->completed_ns = latency_clock_ns();
+        const std::vector<Light> &lights = m_estimation.get_lights();
+        const cv::Mat &completed_depth = m_estimation.get_depth_image();
+
+        // If either algorithm isn't available yet, skip the frame
+        if (lights.empty() || completed_depth.empty()) {
+            m_frame_pool.release(frame);
+            continue;
+        }
+        frame->lights.assign(lights.begin(), lights.end());
+        completed_depth.copyTo(frame->completed_depth);
+
+        // If the depth completion and light estimation took longer than a frame, log it
+        double milliseconds_passed = milliseconds_since(start);
+        if (milliseconds_passed > period_ms) {
+            std::cout << "[PIPELINE]: Missed " << period_ms << " ms deadline for depth completion and light estimation by " 
+                      << milliseconds_passed - period_ms << " milliseconds" << std::endl; 
+        }
+
+        m_estimation_stats.frames++;
+        m_estimation_stats.busy_ms += milliseconds_passed;
+        forward(m_submit_queue, frame);
+    }
+
+    m_submit_queue.close();
+}
+
+void FramePipeline::run_submit()
+{
+    set_profile_thread_name("Submit");
+    Frame* frame;
+    while (m_submit_queue.pop(frame)) {
+        const std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+
+        int index = frame->index;
+        if (m_on_submit) {
+            m_on_submit(index);
+        }
+
+        // When everything is available, we hand the frame over to the renderer.
+        {
+            PROFILE_SCOPE("set_lights");
+            m_renderer.set_lights(frame->lights);
+        }
+        frame->submitted_ns = latency_clock_ns();
+        {
+            PROFILE_SCOPE("set_frame");
+            m_renderer.set_frame(frame);
+        }
+
+        m_submit_stats.frames++;
+        m_submit_stats.busy_ms += milliseconds_since(start);
+        if (m_recording && !m_settings.headless) {
+            m_record_queue.push(index);
+        }
+    }
+
+    m_record_queue.close();
+}
+
+void FramePipeline::run_record()
+{
+    set_profile_thread_name("Record");
+    int index;
+    while (m_record_queue.pop(index)) {
+        const std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+
+        // Copy the renderer contents back to a cv::Mat
+        cv::Mat frame;
+        {
+            PROFILE_SCOPE("get_most_recent_frame");
+            frame = m_renderer.get_most_recent_frame();
+        }
+        if (frame.empty()) {
+            std::cout << "[PIPELINE]: Received empty frame at frame " << index << std::endl;
+        } else {
+            m_recording->write(index, frame);
+        }
+
+        m_record_stats.frames++;
+        m_record_stats.busy_ms += milliseconds_since(start);
+    }
+}
+
+void FramePipeline::forward(BoundedQueue<Frame*> &queue, Frame* frame)
+{
+    std::optional<Frame*> dropped = queue.push(frame);
+    if (dropped) {
+        m_frame_pool.release(*dropped);
+    }
+}
+
+void FramePipeline::print_stats()
+{
+    print_stage("I/O", m_io_stats);
+    print_stage("Tracking", m_tracking_stats);
+    print_stage("Estimation", m_estimation_stats);
+    print_stage("Submit", m_submit_stats);
+    print_stage("Record", m_record_stats);
+
+    print_queue("Tracking", m_tracking_queue.get_stats());
+    print_queue("Estimation", m_estimation_queue.get_stats());
+    print_queue("Submit", m_submit_queue.get_stats());
+    print_queue("Record", m_record_queue.get_stats());
+
+    std::cout << "[PIPELINE]: Camera fell behind schedule on " << m_late_frames << " frames" << std::endl;
+}
+
+DropPolicy FramePipeline::pre_estimation_policy(const PipelineSettings &settings, const EstimationExecutor &estimation)
+{
+    if (settings.drop_policy != DropPolicy::BLOCK && estimation.is_stateful()) {
+        std::cout << "[PIPELINE]: Estimators are stateful, so frames are only dropped after estimation" << std::endl;
+        return DropPolicy::BLOCK;
+    }
+
+    return settings.drop_policy;
+}
@@ -0,0 +1,82 @@
+#include "frame_pool.h"
+
+FramePool::FramePool(int size, int width, int height, int max_key_points, int max_lights) :
+    m_frames(size),
+    m_allocations{0}
+{
+    for (int i = 0; i < size; i++) {
+        Frame &frame = m_frames[i];
+        frame.index = -1;
+        frame.timestamp = 0.0;
+        frame.capture_ns = 0;
+        frame.tracked_ns = 0;
+        frame.completed_ns = 0;
+        frame.submitted_ns = 0;
+        frame.tracking_state = -1;
+
+        frame.rgb_image.create(height, width, CV_8UC3);
+        frame.depth_image.create(height, width, CV_16UC1);
+        frame.completed_depth.create(height, width, CV_32FC1);
+        frame.camera_pose.setIdentity();
+        frame.tracked_points.reserve(max_key_points);
+        frame.key_points.reserve(max_key_points);
+        frame.lights.reserve(max_lights);
+
+        m_buffers.push_back(get_buffers(frame));
+        m_free_frames.push_back(&frame);
+    }
+
+    std::cout << "[FRAME POOL]: Allocated " << size << " frames" << std::endl;
+}
+
+Frame* FramePool::acquire()
+{
+    std::unique_lock<std::mutex> lock(m_pool_mutex);
+    m_frame_released.wait(lock, [this] { return !m_free_frames.empty(); });
+
+    Frame* frame = m_free_frames.back();
+    m_free_frames.pop_back();
+    return frame;
+}
+
+void FramePool::release(Frame* frame)
+{
+    if (!frame) {
+        return;
+    }
+
+    // Any buffer that moved since the last time this frame was released was reallocated
+    int slot = frame - m_frames.data();
+    FrameBuffers buffers = get_buffers(*frame);
+    FrameBuffers &previous = m_buffers[slot];
+    m_allocations += (buffers.rgb_image != previous.rgb_image) +
+                     (buffers.depth_image != previous.depth_image) +
+                     (buffers.completed_depth != previous.completed_depth) +
+                     (buffers.tracked_points != previous.tracked_points) +
+                     (buffers.key_points != previous.key_points) +
+                     (buffers.lights != previous.lights);
+    previous = buffers;
+
+    {
+        std::lock_guard<std::mutex> lock(m_pool_mutex);
+        m_free_frames.push_back(frame);
+    }
+    m_frame_released.notify_one();
+}
+
+int FramePool::get_allocation_count() const
+{
+    return m_allocations;
+}
+
+FramePool::FrameBuffers FramePool::get_buffers(const Frame &frame) const
+{
+    FrameBuffers buffers;
+    buffers.rgb_image = frame.rgb_image.datastart;
+    buffers.depth_image = frame.depth_image.datastart;
+    buffers.completed_depth = frame.completed_depth.datastart;
+    buffers.tracked_points = frame.tracked_points.data();
+    buffers.key_points = frame.key_points.data();
+    buffers.lights = frame.lights.data();
+    return buffers;
+}
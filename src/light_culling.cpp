@@ -0,0 +1,253 @@
+#include "light_culling.h"
+
+namespace
+{
+
+// Same near plane as the camera projection
+const float NEAR_DEPTH = 0.001f;
+
+// Depth is shaded from half floats that are filtered between neighboring pixels, so tiles
+// include the pixels around them, and reach a little farther than the depth they contain.
+const int DEPTH_BORDER = 1;
+const float DEPTH_MARGIN = 1.01f;
+
+float light_brightness(const Light &light)
+{
+    return std::max(light.color.x, std::max(light.color.y, light.color.z));
+}
+
+// Plane through the camera center along a tile boundary at the given
+// image coordinate, with the given axis pointing into the larger coordinates
+Eigen::Vector3f boundary_plane(float coordinate, float focal, float center, int axis)
+{
+    Eigen::Vector3f plane = Eigen::Vector3f::Zero();
+    plane(axis) = 1.0f;
+    plane(2) = -(coordinate - center) / focal;
+    return plane.normalized();
+}
+
+} // namespace
+
+LightGrid::LightGrid(int width, int height, const std::string &camera_settings) :
+    m_width{width},
+    m_height{height},
+    m_tiles_x{(width + TILE_SIZE - 1) / TILE_SIZE},
+    m_tiles_y{(height + TILE_SIZE - 1) / TILE_SIZE},
+    m_light_range{DEFAULT_LIGHT_RANGE},
+    m_num_lights{0},
+    m_dropped_tile_lights{0},
+    m_warned_full_tiles{false},
+    m_data_buffer{0},
+    m_data_texture{0},
+    m_list_buffer{0},
+    m_list_texture{0}
+{
+    cv::FileStorage settings(camera_settings, cv::FileStorage::READ);
+    m_fx = settings["Camera1.fx"];
+    m_fy = settings["Camera1.fy"];
+    m_cx = settings["Camera1.cx"];
+    m_cy = settings["Camera1.cy"];
+
+    for (int x = 0; x <= m_tiles_x; x++) {
+        m_column_planes.push_back(boundary_plane(std::min(x * TILE_SIZE, m_width), m_fx, m_cx, 0));
+    }
+    for (int y = 0; y <= m_tiles_y; y++) {
+        m_row_planes.push_back(boundary_plane(std::min(y * TILE_SIZE, m_height), m_fy, m_cy, 1));
+    }
+
+    // Until there's depth, every tile reaches as far as the lights do
+    const int num_tiles = m_tiles_x * m_tiles_y;
+    m_tile_max_depth.assign(num_tiles, std::numeric_limits<float>::max());
+    m_tile_counts.assign(num_tiles, 0);
+    m_tile_lights.resize(num_tiles * MAX_LIGHTS_PER_TILE);
+    m_column_hits.resize(m_tiles_x);
+    m_row_hits.resize(m_tiles_y);
+}
+
+void LightGrid::init_buffers()
+{
+    glGenBuffers(1, &m_data_buffer);
+    glGenBuffers(1, &m_list_buffer);
+    glGenTextures(1, &m_data_texture);
+    glGenTextures(1, &m_list_texture);
+
+    // Buffers can't be empty, so they start out with room for a single light and tile
+    const glm::vec4 no_light(0.0f);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_data_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4), &no_light, GL_STREAM_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, m_data_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_data_buffer);
+
+    const int32_t no_tile[2] = {0, 0};
+    glBindBuffer(GL_TEXTURE_BUFFER, m_list_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(no_tile), no_tile, GL_STREAM_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, m_list_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, m_list_buffer);
+
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightGrid::set_light_range(float light_range)
+{
+    m_light_range = std::max(0.0f, light_range);
+}
+
+void LightGrid::set_depth(const cv::Mat &completed_depth)
+{
+    if (completed_depth.rows != m_height || completed_depth.cols != m_width || completed_depth.type() != CV_32FC1) {
+        std::fill(m_tile_max_depth.begin(), m_tile_max_depth.end(), std::numeric_limits<float>::max());
+        return;
+    }
+
+    // Pixels without depth are never shaded, and don't extend their tile
+    cv::parallel_for_(cv::Range(0, m_tiles_y), [&](const cv::Range &range) {
+        for (int ty = range.start; ty < range.end; ty++) {
+            const int v0 = std::max(0, ty * TILE_SIZE - DEPTH_BORDER);
+            const int v1 = std::min(m_height, (ty + 1) * TILE_SIZE + DEPTH_BORDER);
+            for (int tx = 0; tx < m_tiles_x; tx++) {
+                const int u0 = std::max(0, tx * TILE_SIZE - DEPTH_BORDER);
+                const int u1 = std::min(m_width, (tx + 1) * TILE_SIZE + DEPTH_BORDER);
+
+                float max_depth = 0.0f;
+                for (int v = v0; v < v1; v++) {
+                    const float* depth = completed_depth.ptr<float>(v);
+                    for (int u = u0; u < u1; u++) {
+                        max_depth = std::max(max_depth, depth[u]);
+                    }
+                }
+                m_tile_max_depth[ty * m_tiles_x + tx] = max_depth * DEPTH_MARGIN;
+            }
+        }
+    });
+}
+
+void LightGrid::cull(const std::vector<Light> &lights, const Eigen::Matrix4f &camera_pose)
+{
+    m_num_lights = lights.size();
+    m_light_data.resize(2 * std::max(m_num_lights, 1));
+    for (int i = 0; i < m_num_lights; i++) {
+        const Light &light = lights[i];
+        m_light_data[2 * i] = glm::vec4(light.position, get_light_range(light));
+        m_light_data[2 * i + 1] = glm::vec4(light.color, light.intensity);
+    }
+
+    // Lights are binned from brightest to dimmest, so full tiles keep the ones that matter most
+    m_order.resize(m_num_lights);
+    std::iota(m_order.begin(), m_order.end(), 0);
+    std::stable_sort(m_order.begin(), m_order.end(), [&](int a, int b) {
+        return light_brightness(lights[a]) > light_brightness(lights[b]);
+    });
+
+    std::fill(m_tile_counts.begin(), m_tile_counts.end(), 0);
+    m_dropped_tile_lights = 0;
+    const Eigen::Matrix3f rotation = camera_pose.topLeftCorner<3, 3>();
+    const Eigen::Vector3f translation = camera_pose.topRightCorner<3, 1>();
+    for (int i = 0; i < m_num_lights; i++) {
+        const int index = m_order[i];
+        const float range = m_light_data[2 * index].w;
+        const Eigen::Vector3f position = rotation * Eigen::Vector3f(lights[index].position.x, lights[index].position.y, lights[index].position.z) + translation;
+        if (range <= 0.0f || position(2) + range < NEAR_DEPTH) {
+            continue;
+        }
+
+        // The side planes of a tile only depend on its column or row, so the light's
+        // sphere is tested against each of them once, and then against each tile's depth
+        bool any_column = false, any_row = false;
+        for (int x = 0; x < m_tiles_x; x++) {
+            m_column_hits[x] = m_column_planes[x].dot(position) >= -range && m_column_planes[x + 1].dot(position) <= range;
+            any_column |= m_column_hits[x];
+        }
+        for (int y = 0; y < m_tiles_y; y++) {
+            m_row_hits[y] = m_row_planes[y].dot(position) >= -range && m_row_planes[y + 1].dot(position) <= range;
+            any_row |= m_row_hits[y];
+        }
+        if (!any_column || !any_row) {
+            continue;
+        }
+
+        for (int y = 0; y < m_tiles_y; y++) {
+            if (!m_row_hits[y]) {
+                continue;
+            }
+            for (int x = 0; x < m_tiles_x; x++) {
+                const int tile = y * m_tiles_x + x;
+                if (!m_column_hits[x] || position(2) - range > m_tile_max_depth[tile]) {
+                    continue;
+                }
+                if (m_tile_counts[tile] >= MAX_LIGHTS_PER_TILE) {
+                    m_dropped_tile_lights++;
+                    continue;
+                }
+                m_tile_lights[tile * MAX_LIGHTS_PER_TILE + m_tile_counts[tile]++] = index;
+            }
+        }
+    }
+
+    // Full tiles are only logged once, the count is shown every frame
+    if (m_dropped_tile_lights > 0 && !m_warned_full_tiles) {
+        std::cerr << "[LIGHT CULLING]: More than " << MAX_LIGHTS_PER_TILE << " lights reach some tiles, "
+                  << "which dropped " << m_dropped_tile_lights << " of their dimmest lights" << std::endl;
+        m_warned_full_tiles = true;
+    }
+
+    // The offset and count of every tile come first, then all the lists back to back
+    const int num_tiles = m_tiles_x * m_tiles_y;
+    m_light_lists.resize(2 * num_tiles);
+    for (int tile = 0; tile < num_tiles; tile++) {
+        m_light_lists[2 * tile] = m_light_lists.size();
+        m_light_lists[2 * tile + 1] = m_tile_counts[tile];
+        const int32_t* tile_lights = &m_tile_lights[tile * MAX_LIGHTS_PER_TILE];
+        m_light_lists.insert(m_light_lists.end(), tile_lights, tile_lights + m_tile_counts[tile]);
+    }
+}
+
+void LightGrid::upload(GLenum data_unit, GLenum list_unit)
+{
+    // Respecifying the whole buffer lets the driver orphan the storage the previous frame reads from
+    glBindBuffer(GL_TEXTURE_BUFFER, m_data_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, m_light_data.size() * sizeof(glm::vec4), m_light_data.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_list_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, m_light_lists.size() * sizeof(int32_t), m_light_lists.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glActiveTexture(data_unit);
+    glBindTexture(GL_TEXTURE_BUFFER, m_data_texture);
+    glActiveTexture(list_unit);
+    glBindTexture(GL_TEXTURE_BUFFER, m_list_texture);
+}
+
+int LightGrid::get_tiles_x() const
+{
+    return m_tiles_x;
+}
+
+int LightGrid::get_tiles_y() const
+{
+    return m_tiles_y;
+}
+
+int LightGrid::get_light_count() const
+{
+    return m_num_lights;
+}
+
+double LightGrid::get_average_tile_lights() const
+{
+    return static_cast<double>(std::accumulate(m_tile_counts.begin(), m_tile_counts.end(), 0)) / m_tile_counts.size();
+}
+
+int LightGrid::get_max_tile_lights() const
+{
+    return *std::max_element(m_tile_counts.begin(), m_tile_counts.end());
+}
+
+int LightGrid::get_dropped_tile_lights() const
+{
+    return m_dropped_tile_lights;
+}
+
+float LightGrid::get_light_range(const Light &light) const
+{
+    return m_light_range * std::sqrt(std::max(0.0f, light_brightness(light) * light.intensity));
+}
@@ -17,6 +17,17 @@ const std::vector<Light>& LightEstimator::get_lights() const
     return m_lights;
 }
 
+// Implementations have to opt in to running concurrently or out of order
+bool LightEstimator::is_thread_safe() const
+{
+    return false;
+}
+
+bool LightEstimator::is_stateful() const
+{
+    return true;
+}
+
 // Implementation definitions
 RandLightEstimator::RandLightEstimator(int num_lights) :
     LightEstimator{num_lights},
@@ -46,6 +57,16 @@ void RandLightEstimator::estimate_lights(const cv::Mat &rgb_image, const cv::Mat
     std::cout << "[LIGHT ESTIMATOR]: Light source estimation complete" << std::endl;
 }
 
+bool RandLightEstimator::is_thread_safe() const
+{
+    return false;
+}
+
+bool RandLightEstimator::is_stateful() const
+{
+    return true;
+}
+
 float RandLightEstimator::rand_float() const
 {
     return ((float) std::rand() / RAND_MAX) * 2.0f - 1.0f;
@@ -67,4 +88,14 @@ ConstLightEstimator::ConstLightEstimator(int num_lights) :
 void ConstLightEstimator::estimate_lights(const cv::Mat &rgb_image, const cv::Mat &depth_image)
 {
     return;
+}
+
+bool ConstLightEstimator::is_thread_safe() const
+{
+    return true;
+}
+
+bool ConstLightEstimator::is_stateful() const
+{
+    return false;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include <chrono>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <sstream> 
 #include <string>
 #include <thread>
@@ -10,15 +11,44 @@
 
 #include "renderer.h"
 #include "camera_stream.h"
+#include "frame_pipeline.h"
+#include "frame_pool.h"
 #include "depth_completion.h"
+#include "recording_sink.h"
+#include "slam_trace.h"
 #include "light_estimation.h"
+#include "util/profile_util.h"
 
+// Lights are culled per screen tile when rendering, so the estimators can produce any number.
+// Both the count and how far the lights reach can be set from the command line.
 const int NUM_LIGHTS = 4;
 
-std::vector<std::tuple<int, cv::Mat, cv::Mat, float>> read_recording(const std::string &filepath) 
+// Frames are decoded in the background while earlier frames are tracked
+const int NUM_DECODER_THREADS = 2;
+const int DECODER_READ_AHEAD = 4;
+
+// The camera produces a frame every 17 ms (~60 FPS), and each pipeline stage
+// can queue up a couple of frames for the next one before applying the drop policy.
+const std::chrono::microseconds FRAME_PERIOD(17000);
+const int PIPELINE_QUEUE_CAPACITY = 2;
+const DropPolicy PIPELINE_DROP_POLICY = DropPolicy::BLOCK;
+
+// Rendered frames wait here while the recording is encoded, and are dropped past that
+const int RECORDING_QUEUE_CAPACITY = 8;
+
+// Light estimation and depth completion share a pool of worker threads
+const int NUM_ESTIMATION_THREADS = 2;
+
+// Frames are recycled between the pipeline stages and the renderer, so there have to be
+// enough for every queue, every stage, and the pending and drawn frames in the renderer.
+// There also shouldn't be more key points than ORB features.
+const int FRAME_POOL_SIZE = 3 * PIPELINE_QUEUE_CAPACITY + 4 + 2;
+const int MAX_KEY_POINTS = 1500;
+
+std::vector<std::tuple<int, Eigen::Vector3f, Eigen::Vector3f, float>> read_recording(const std::string &filepath) 
 {
     std::ifstream record_file (filepath);
-    std::vector<std::tuple<int, cv::Mat, cv::Mat, float>> ret;
+    std::vector<std::tuple<int, Eigen::Vector3f, Eigen::Vector3f, float>> ret;
 
     if (!record_file.is_open()) {
         return ret;
@@ -36,8 +66,8 @@ std::vector<std::tuple<int, cv::Mat, cv::Mat, float>> read_recording(const std::
             float o_x, o_y, o_z, n_x, n_y, n_z, orientation;
             ss >> index >> o_x >> o_y >> o_z >> n_x >> n_y >> n_z >> orientation;
 
-            cv::Mat origin = (cv::Mat_<float>(3, 1) << o_x, o_y, o_z);
-            cv::Mat normal = (cv::Mat_<float>(3, 1) << n_x, n_y, n_z);
+            Eigen::Vector3f origin(o_x, o_y, o_z);
+            Eigen::Vector3f normal(n_x, n_y, n_z);
             ret.push_back(std::make_tuple(index, origin, normal, orientation));
         }
     }
@@ -45,35 +75,78 @@ std::vector<std::tuple<int, cv::Mat, cv::Mat, float>> read_recording(const std::
     return ret;
 }
 
-void write_recording(const std::string &filepath, const std::vector<std::tuple<int, cv::Mat, cv::Mat, float>> &recordings)
+void write_recording(const std::string &filepath, const std::vector<std::tuple<int, Eigen::Vector3f, Eigen::Vector3f, float>> &recordings)
 {
     std::ofstream record_file(filepath);
 
     for (int i = 0; i < recordings.size(); i++) {
-        const std::tuple<int, cv::Mat, cv::Mat, float> &recording = recordings[i];
+        const std::tuple<int, Eigen::Vector3f, Eigen::Vector3f, float> &recording = recordings[i];
 
         int index = std::get<0>(recording);
-        const cv::Mat &origin = std::get<1>(recording);
-        const cv::Mat &normal = std::get<2>(recording);
+        const Eigen::Vector3f &origin = std::get<1>(recording);
+        const Eigen::Vector3f &normal = std::get<2>(recording);
         float orientation = std::get<3>(recording);
 
         record_file << index << " " <<
-                       origin.at<float>(0, 0) << " " << origin.at<float>(0, 1) << " " << origin.at<float>(0, 2) << " " <<
-                       normal.at<float>(0, 0) << " " << normal.at<float>(0, 1) << " " << normal.at<float>(0, 2) << " " <<
+                       origin(0) << " " << origin(1) << " " << origin(2) << " " <<
+                       normal(0) << " " << normal(1) << " " << normal(2) << " " <<
                        orientation << std::endl;
     }  
 
     record_file.close();
 }
 
+// Options of the form --name=value can be given anywhere, and are removed
+// from argv so that the positional arguments keep their order.
+std::map<std::string, std::string> parse_options(int &argc, char* argv[])
+{
+    std::map<std::string, std::string> options;
+
+    int positional = 1;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) == 0) {
+            size_t split = arg.find('=');
+            if (split == std::string::npos) {
+                options[arg.substr(2)] = "";
+            } else {
+                options[arg.substr(2, split - 2)] = arg.substr(split + 1);
+            }
+        } else {
+            argv[positional] = argv[i];
+            positional++;
+        }
+    }
+    argc = positional;
+
+    return options;
+}
+
+std::string get_option(const std::map<std::string, std::string> &options, const std::string &name, const std::string &default_value)
+{
+    std::map<std::string, std::string>::const_iterator it = options.find(name);
+    return (it == options.end()) ? default_value : it->second;
+}
+
 int main(int argc, char* argv[])
 {
+    std::map<std::string, std::string> options = parse_options(argc, argv);
+
     if (argc < 6) {
-        std::cerr << "Usage: ./mixed_reality [vocabulary_file] [settings_file] [shader_dir] [model_file] [dataset_dir] [(optional) record_file] [(optional) record_video]" << std::endl;
+        std::cerr << "Usage: ./mixed_reality [vocabulary_file] [settings_file] [shader_dir] [model_file] [dataset_dir or packed_dataset] [(optional) record_file] [(optional) record_video]" << std::endl;
         // Optional argument at the end: filepath to record when the objects were placed
+        std::cerr << "Options: --depth=[offline|morphological|guided] --temporal=[on|off] --headless=[on|off] --trace-out=[trace_file] --replay=[trace_file] --profile=[trace.json] --latency-csv=[csv_file] --lights=[count] --light-range=[meters]" << std::endl;
         return -1;
     }
 
+    // Per-stage timings are written as a Chrome trace and summarized at exit. Profiling
+    // has to start before any of the threads do, including the decoders.
+    std::string profile_path = get_option(options, "profile", "");
+    if (!profile_path.empty()) {
+        enable_profiling();
+        set_profile_thread_name("Main");
+    }
+
     // Parse the dataset type from the given arguments
     std::string settings = argv[2];
     OfflineDatasetType type;
@@ -88,20 +161,61 @@ int main(int argc, char* argv[])
 
     // When optional filepath is provided, open the file and check if there is already a recording.
     // If there is, then read from the recording, otherwise we write to the recording.
-    std::vector<std::tuple<int, cv::Mat, cv::Mat, float>> recordings;
+    std::vector<std::tuple<int, Eigen::Vector3f, Eigen::Vector3f, float>> recordings;
     bool record_file_exists = false, read_or_write = false;
-    std::string video_dir = "";
+    std::string video_path = "";
     if (argc > 6) {
         record_file_exists = true;
         recordings = read_recording(argv[6]);
         read_or_write = (recordings.size() > 0);
         if (argc > 7) {
-            video_dir = argv[7];
+            video_path = argv[7];
         }
     }
 
-    // Camera implementation
-    CameraStream* camera = new OfflineCameraStream(argv[5], type);
+    // Camera implementation, where the dataset is either a directory or a packed dataset.
+    // Precomputed depths still live next to the original dataset.
+    CameraStream* camera;
+    std::string dataset_dir = argv[5];
+    if (is_packed_dataset(argv[5])) {
+        PackedCameraStream* packed_camera = new PackedCameraStream(argv[5]);
+        dataset_dir = packed_camera->get_dataset().get_source_dir();
+        camera = packed_camera;
+    } else {
+        camera = new OfflineCameraStream(argv[5], type, NUM_DECODER_THREADS, DECODER_READ_AHEAD);
+    }
+
+    // Implementations of light source estimation and depth completion
+    int num_lights = std::stoi(get_option(options, "lights", std::to_string(NUM_LIGHTS)));
+    float light_range = std::stof(get_option(options, "light-range", std::to_string(LightGrid::DEFAULT_LIGHT_RANGE)));
+    if (num_lights < 0 || light_range <= 0.0f) {
+        std::cerr << "Invalid light count or range provided" << std::endl;
+        return -1;
+    }
+    LightEstimator* light_estimator = new ConstLightEstimator(num_lights);
+    DepthCompleter* depth_completer;
+    std::string depth_option = get_option(options, "depth", "offline");
+    if (depth_option == "offline") {
+        depth_completer = new OfflineDepthCompleter(dataset_dir, "table3-ctrl_", type);
+    } else if (depth_option == "morphological") {
+        depth_completer = new MorphologicalDepthCompleter(type);
+    } else if (depth_option == "guided") {
+        depth_completer = new GuidedDepthCompleter(type);
+    } else {
+        std::cerr << "Invalid depth completer provided" << std::endl;
+        return -1;
+    }
+
+    // Runtime completers can reuse the previous frame's depth where the camera pose allows it
+    DepthCompleter* frame_completer = nullptr;
+    if (get_option(options, "temporal", "off") == "on") {
+        if (depth_option == "offline") {
+            std::cerr << "Offline depths can't be completed incrementally" << std::endl;
+            return -1;
+        }
+        frame_completer = depth_completer;
+        depth_completer = new TemporalDepthCompleter(*frame_completer, type, argv[2]);
+    }
 
     // The window dimensions are slightly different
     // from the actual image dimensions because
@@ -109,106 +223,119 @@ int main(int argc, char* argv[])
     // when we copy the image data to OpenGL.
     int width = camera->get_width(), height = camera->get_height();
 
+    // Headless runs render offscreen as fast as the pipeline allows, for batch processing
+    bool headless = (get_option(options, "headless", "off") == "on");
+
+    // Rendered frames are recorded to a video, raw frames, or a directory of PNGs
+    RecordingSink* recording = nullptr;
+    if (!video_path.empty()) {
+        try {
+            double fps = 1.0e6 / FRAME_PERIOD.count();
+            DropPolicy policy = headless ? DropPolicy::BLOCK : DropPolicy::DROP_NEWEST;
+            recording = new RecordingSink(video_path, width, height, fps, RECORDING_QUEUE_CAPACITY, policy);
+        } catch (const std::runtime_error &e) {
+            std::cerr << e.what() << std::endl;
+            return -1;
+        }
+    }
+
+    // Tracking results can be recorded to a trace, or replayed from one without running SLAM at all
+    SlamTraceWriter* trace_writer = nullptr;
+    SlamTraceReader* trace_reader = nullptr;
+    std::string trace_out = get_option(options, "trace-out", "");
+    std::string replay = get_option(options, "replay", "");
+    try {
+        if (!replay.empty()) {
+            trace_reader = new SlamTraceReader(replay);
+        } else if (!trace_out.empty()) {
+            trace_writer = new SlamTraceWriter(trace_out);
+        }
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
     // Start the SLAM and renderer threads
-    ORB_SLAM3::System SLAM(argv[1], argv[2], ORB_SLAM3::System::RGBD, false);
-    Renderer renderer(width, height, 1.0f, argv[2], argv[3], argv[4]);
+    ORB_SLAM3::System* SLAM = nullptr;
+    if (!trace_reader) {
+        SLAM = new ORB_SLAM3::System(argv[1], argv[2], ORB_SLAM3::System::RGBD, false);
+    }
+    FramePool frame_pool(FRAME_POOL_SIZE, width, height, MAX_KEY_POINTS, num_lights);
+    Renderer renderer(width, height, 1.0f, argv[2], argv[3], argv[4], frame_pool, headless);
+    if (headless && recording) {
+        renderer.set_readback_callback([&](int index, const cv::Mat &image) { recording->write(index, image); });
+    }
+    renderer.set_light_range(light_range);
+    std::string latency_csv = get_option(options, "latency-csv", "");
+    if (!latency_csv.empty() && !renderer.set_latency_csv(latency_csv)) {
+        return -1;
+    }
     std::thread thread = std::thread(&Renderer::run, &renderer);
 
     // Arbitrary time for the renderer to initialize
     std::this_thread::sleep_for(std::chrono::milliseconds(16));
 
-    // Implementations of light source estimation and depth completion
-    LightEstimator* light_estimator = new ConstLightEstimator(NUM_LIGHTS);
-    DepthCompleter* depth_completer = new OfflineDepthCompleter(argv[5], "table3-ctrl_", type);
-
-    // The completed depths have 4 fewer frames than the dataset,
-    // so we have to adjust for the indexing.
+    // The pipeline runs every stage on its own thread, and the camera
+    // produces frames at roughly 60 FPS. Every frame is processed by default.
+    PipelineSettings pipeline_settings;
+    pipeline_settings.width = width;
+    pipeline_settings.height = height;
+    pipeline_settings.frame_period = FRAME_PERIOD;
+    pipeline_settings.queue_capacity = PIPELINE_QUEUE_CAPACITY;
+    pipeline_settings.drop_policy = PIPELINE_DROP_POLICY;
+    pipeline_settings.headless = headless;
+    ThreadPool estimation_pool(NUM_ESTIMATION_THREADS);
+    EstimationExecutor estimation(estimation_pool, *light_estimator, *depth_completer);
+    FramePipeline pipeline(pipeline_settings, *camera, SLAM, estimation, renderer, frame_pool);
+    pipeline.set_recording_sink(recording);
+    pipeline.set_trace_writer(trace_writer);
+    pipeline.set_trace_reader(trace_reader);
+
+    // If we're reading from a recording, check if we're at an object.
+    // Otherwise if we're recording, check if an object was added.
     int record_idx = 0;
-    int num_frames = camera->get_frame_count();
-    for (int i = 0; i < num_frames; i++) {
-        std::tuple<cv::Mat, cv::Mat, double> stream = camera->get_stream();
-
-        cv::Mat rgb_image, depth_image;
-        cv::resize(std::get<0>(stream), rgb_image, cv::Size(width, height));
-        cv::resize(std::get<1>(stream), depth_image, cv::Size(width, height));
-        double timestamp = std::get<2>(stream);
-
-        // We always want to update the pose whenever we update the image
-        cv::Mat camera_pose = ORB_SLAM3::Converter::toCvMat(SLAM.TrackRGBD(rgb_image, depth_image, timestamp).matrix());
-        int state = SLAM.GetTrackingState();
-		std::vector<ORB_SLAM3::MapPoint*> map_points = SLAM.GetTrackedMapPoints();
-		std::vector<cv::KeyPoint> key_points = SLAM.GetTrackedKeyPointsUn();
-
-        // Estimate lights and complete depth
-        const std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
-
-        light_estimator->estimate_lights(rgb_image, depth_image);
-        std::vector<Light> lights = light_estimator->get_lights();
-
-        depth_completer->complete_depth_image(depth_image);
-        cv::Mat completed_depth = depth_completer->get_depth_image();
-
-        // If either algorithm isn't available yet, skip the frame
-        if (lights.empty() || completed_depth.empty()) {
-            continue;
-        }
-        cv::resize(completed_depth, completed_depth, cv::Size(width, height));
-
-        const std::chrono::time_point<std::chrono::system_clock> end = std::chrono::system_clock::now();
-
-        // If the depth completion and light estimation took longer than 17 ms (~60 FPS), log it
-        int milliseconds_passed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-        if (milliseconds_passed > 17) {
-            std::cout << "[MAIN LOOP]: Missed 17 ms deadline for depth completion and light estimation by " << milliseconds_passed - 17 << " milliseconds" << std::endl; 
+    pipeline.set_submit_callback([&](int i) {
+        if (!record_file_exists) {
+            return;
         }
 
-        // When everything is available, we pass the information to the renderer.
-        renderer.set_slam(camera_pose, map_points, key_points);
-        renderer.set_images(rgb_image, completed_depth);
-        renderer.set_lights(lights);
-
-        // If we're reading from a recording, check if we're at an object.
-        // Otherwise if we're recording, check if an object was added.
-        if (record_file_exists) {
-            if (read_or_write) {
-                std::tuple<int, cv::Mat, cv::Mat, float> &record = recordings[record_idx];
-
-                // If we're at a frame where an object was recorded, add it.
-                if (std::get<0>(record) == i) {
-                    renderer.add_object(std::get<1>(record), std::get<2>(record), std::get<3>(record));
-                    std::cout << "[MAIN LOOP]: Adding recorded object at frame " << i << std::endl;
-                    record_idx++;
-                }
-            } else {
-                Plane* object_added = renderer.get_most_recent_object();
-                if (object_added) {
-                    std::tuple<cv::Mat, cv::Mat, float> info = object_added->get_plane_information();
-                    recordings.push_back(std::make_tuple(i, std::get<0>(info), std::get<1>(info), std::get<2>(info)));
-                    std::cout << "[MAIN LOOP]: Recording object added at frame " << i << std::endl;
-                }
+        if (read_or_write) {
+            // If we're at (or dropped) a frame where an object was recorded, add it.
+            while (record_idx < recordings.size() && std::get<0>(recordings[record_idx]) <= i) {
+                std::tuple<int, Eigen::Vector3f, Eigen::Vector3f, float> &record = recordings[record_idx];
+                renderer.add_object(std::get<1>(record), std::get<2>(record), std::get<3>(record));
+                std::cout << "[MAIN LOOP]: Adding recorded object at frame " << i << std::endl;
+                record_idx++;
             }
-        }
-
-        // If we're recording video, copy the renderer contents back to a cv::Mat
-        if (!video_dir.empty()) {
-            cv::Mat frame = renderer.get_most_recent_frame();
-            if (frame.empty()) {
-                std::cout << "[MAIN LOOP]: Received empty frame at frame " << i << std::endl;
-            } else {
-                std::string frame_id = std::to_string(i);
-                int padding = 5 - frame_id.length();
-                frame_id.insert(0, padding, '0');
-                frame_id += ".png";
-                cv::imwrite(video_dir + '/' + frame_id, frame);
+        } else {
+            std::tuple<Eigen::Vector3f, Eigen::Vector3f, float> info;
+            if (renderer.get_most_recent_object(info)) {
+                recordings.push_back(std::make_tuple(i, std::get<0>(info), std::get<1>(info), std::get<2>(info)));
+                std::cout << "[MAIN LOOP]: Recording object added at frame " << i << std::endl;
             }
         }
+    });
 
-        // This controls the offline camera's speed 
-        std::this_thread::sleep_for(std::chrono::milliseconds(17 - milliseconds_passed));
-    }
+    pipeline.run();
 
+    // A headless renderer finishes every frame it was given before stopping,
+    // and only then is the recording complete.
     renderer.close();
     thread.join();
+    if (recording) {
+        recording->close();
+    }
+
+    // Motion-to-photon latency of every presented frame
+    renderer.get_latency_monitor().print_summary();
+    renderer.get_latency_monitor().close_csv();
+
+    std::cout << "[MAIN LOOP]: " << frame_pool.get_allocation_count() << " pooled frame buffer reallocations after warm-up" << std::endl;
+
+    if (!profile_path.empty()) {
+        print_profile_summary();
+        write_profile_trace(profile_path);
+    }
 
     // If we recorded objects, write out to the file
     if (record_file_exists && !read_or_write) {
@@ -218,6 +345,11 @@ int main(int argc, char* argv[])
     delete camera;
     delete light_estimator;
     delete depth_completer;
+    delete frame_completer;
+    delete recording;
+    delete trace_writer;
+    delete trace_reader;
+    delete SLAM;
 
     return 0;
 }
\ No newline at end of file
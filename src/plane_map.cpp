@@ -0,0 +1,304 @@
+#include "plane_map.h"
+
+namespace
+{
+
+// Same quality requirement as the points used for plane detection
+const int MIN_OBSERVATIONS = 5;
+
+// Points are assigned within a few times the plane's thickness, in meters
+const float ASSIGN_THICKNESS_SCALE = 3.0f;
+const float MIN_ASSIGN_DISTANCE = 0.01f;
+const float MAX_ASSIGN_DISTANCE = 0.05f;
+
+// Planes can grow beyond their current extent, but not to the other side of the map
+const float EXTENT_SCALE = 2.0f;
+const float EXTENT_MARGIN = 0.3f;
+
+// Positions are only updated once the SLAM map moved a point noticeably
+const float MOVE_DISTANCE = 0.005f;
+
+// Planes need a few points to be refit, and enough visible points to place objects on
+const int MIN_FIT_POINTS = 10;
+const int MIN_VISIBLE_POINTS = 20;
+
+// Fragments within 5 degrees of each other, that lie on each other's plane, are merged
+const float MERGE_COS_ANGLE = 0.996f;
+
+Eigen::Vector3f to_eigen(const cv::Point3f &point)
+{
+    return Eigen::Vector3f(point.x, point.y, point.z);
+}
+
+bool is_candidate(const TrackedPoint &point)
+{
+    return point.id >= 0 && !point.bad && point.observations > MIN_OBSERVATIONS;
+}
+
+} // namespace
+
+void MapPlane::add_point(const Eigen::Vector3f &point, double weight)
+{
+    const Eigen::Vector3d p = point.cast<double>();
+    count += weight;
+    sum += weight * p;
+    sum_squares += weight * p * p.transpose();
+    changed = true;
+}
+
+bool MapPlane::refit()
+{
+    changed = false;
+    if (count < MIN_FIT_POINTS) {
+        return false;
+    }
+
+    // The normal is the direction of least variance
+    const Eigen::Vector3d mean = sum / count;
+    const Eigen::Matrix3d covariance = sum_squares / count - mean * mean.transpose();
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+    solver.computeDirect(covariance);
+
+    // Eigenvalues are sorted in increasing order, and the normal keeps facing the same side
+    Eigen::Vector3f new_normal = solver.eigenvectors().col(0).cast<float>().normalized();
+    if (new_normal.dot(normal) < 0.0f) {
+        new_normal = -new_normal;
+    }
+
+    centroid = mean.cast<float>();
+    normal = new_normal;
+    thickness = std::sqrt(std::max(0.0, solver.eigenvalues()(0)));
+    extent = std::sqrt(std::max(0.0, solver.eigenvalues()(2)));
+    return true;
+}
+
+float MapPlane::get_reach() const
+{
+    return std::min(MAX_ASSIGN_DISTANCE, std::max(MIN_ASSIGN_DISTANCE, ASSIGN_THICKNESS_SCALE * thickness));
+}
+
+float MapPlane::get_extent_reach() const
+{
+    return EXTENT_SCALE * extent + EXTENT_MARGIN;
+}
+
+PlaneMap::PlaneMap() :
+    m_next_id{0}
+{
+
+}
+
+void PlaneMap::update(const std::vector<TrackedPoint> &points)
+{
+    if (m_planes.empty()) {
+        return;
+    }
+
+    for (int i = 0; i < points.size(); i++) {
+        const TrackedPoint &point = points[i];
+        if (point.id < 0) {
+            continue;
+        }
+
+        const Eigen::Vector3f position = to_eigen(point.position);
+        std::unordered_map<long, Assignment>::iterator it = m_assignments.find(point.id);
+        if (it != m_assignments.end()) {
+            // Culled points are removed, and moved points are removed and added again
+            if (point.bad) {
+                unassign_point(it);
+            } else if ((position - it->second.position).squaredNorm() > MOVE_DISTANCE * MOVE_DISTANCE) {
+                int plane = it->second.plane;
+                unassign_point(it);
+                const MapPlane &map_plane = m_planes.at(plane);
+                if (std::abs(map_plane.normal.dot(position - map_plane.centroid)) < map_plane.get_reach()) {
+                    assign_point(point.id, plane, position);
+                }
+            }
+        } else if (is_candidate(point)) {
+            int plane = find_plane(position);
+            if (plane >= 0) {
+                assign_point(point.id, plane, position);
+            }
+        }
+    }
+
+    refit_planes();
+}
+
+void PlaneMap::add_plane(Plane* object, const std::vector<TrackedPoint> &points)
+{
+    std::tuple<Eigen::Vector3f, Eigen::Vector3f, float> information = object->get_plane_information();
+
+    const int id = m_next_id++;
+    MapPlane &plane = m_planes[id];
+    plane.count = 0.0;
+    plane.sum.setZero();
+    plane.sum_squares.setZero();
+    plane.centroid = std::get<0>(information);
+    plane.normal = std::get<1>(information).normalized();
+    plane.thickness = MAX_ASSIGN_DISTANCE / ASSIGN_THICKNESS_SCALE;
+    plane.extent = 0.0f;
+    plane.changed = false;
+    plane.anchors.push_back(object);
+
+    // Until it's refit, the detected plane takes any unassigned point close to it
+    for (int i = 0; i < points.size(); i++) {
+        const TrackedPoint &point = points[i];
+        if (is_candidate(point) && m_assignments.find(point.id) == m_assignments.end()) {
+            const Eigen::Vector3f position = to_eigen(point.position);
+            if (std::abs(plane.normal.dot(position - plane.centroid)) < MAX_ASSIGN_DISTANCE) {
+                assign_point(point.id, id, position);
+            }
+        }
+    }
+
+    refit_planes();
+    std::cout << "[PLANE MAP]: Tracking " << m_planes.size() << " planes" << std::endl;
+}
+
+Plane* PlaneMap::anchor_object(const std::vector<TrackedPoint> &points)
+{
+    // Count the visible points of every plane, along with where they are
+    std::map<int, std::pair<int, Eigen::Vector3f>> visible;
+    for (int i = 0; i < points.size(); i++) {
+        const TrackedPoint &point = points[i];
+        if (point.id < 0 || point.bad) {
+            continue;
+        }
+
+        std::unordered_map<long, Assignment>::const_iterator it = m_assignments.find(point.id);
+        if (it != m_assignments.end()) {
+            std::pair<int, Eigen::Vector3f> &plane_points = visible.emplace(it->second.plane, std::make_pair(0, Eigen::Vector3f::Zero())).first->second;
+            plane_points.first++;
+            plane_points.second += to_eigen(point.position);
+        }
+    }
+
+    int best_plane = -1, best_count = MIN_VISIBLE_POINTS - 1;
+    for (std::map<int, std::pair<int, Eigen::Vector3f>>::const_iterator it = visible.begin(); it != visible.end(); it++) {
+        if (it->second.first > best_count) {
+            best_plane = it->first;
+            best_count = it->second.first;
+        }
+    }
+    if (best_plane < 0) {
+        return nullptr;
+    }
+
+    // The object goes where the visible part of the plane is, like a newly detected plane
+    MapPlane &plane = m_planes.at(best_plane);
+    Eigen::Vector3f origin = visible[best_plane].second / best_count;
+    origin -= plane.normal.dot(origin - plane.centroid) * plane.normal;
+
+    float orientation = -3.14f / 2 + ((float) rand() / RAND_MAX) * 3.14f;
+    Plane* object = new Plane(origin, plane.normal, orientation);
+    plane.anchors.push_back(object);
+    return object;
+}
+
+int PlaneMap::get_plane_count() const
+{
+    return m_planes.size();
+}
+
+int PlaneMap::find_plane(const Eigen::Vector3f &position) const
+{
+    int closest = -1;
+    float closest_distance = std::numeric_limits<float>::max();
+    for (std::map<int, MapPlane>::const_iterator it = m_planes.begin(); it != m_planes.end(); it++) {
+        const MapPlane &plane = it->second;
+        const Eigen::Vector3f offset = position - plane.centroid;
+        const float distance = std::abs(plane.normal.dot(offset));
+        if (distance < plane.get_reach() && distance < closest_distance &&
+            (offset - distance * plane.normal).norm() < plane.get_extent_reach()) {
+            closest = it->first;
+            closest_distance = distance;
+        }
+    }
+    return closest;
+}
+
+void PlaneMap::assign_point(long id, int plane, const Eigen::Vector3f &position)
+{
+    m_planes.at(plane).add_point(position, 1.0);
+    m_assignments[id] = {plane, position};
+}
+
+void PlaneMap::unassign_point(std::unordered_map<long, Assignment>::iterator it)
+{
+    m_planes.at(it->second.plane).add_point(it->second.position, -1.0);
+    m_assignments.erase(it);
+}
+
+void PlaneMap::refit_planes()
+{
+    bool refit = false;
+    for (std::map<int, MapPlane>::iterator it = m_planes.begin(); it != m_planes.end();) {
+        // Planes that lost all their points are forgotten, unless objects are placed on them
+        if (it->second.count < 0.5 && it->second.anchors.empty()) {
+            it = m_planes.erase(it);
+            continue;
+        }
+
+        if (it->second.changed && it->second.refit()) {
+            update_anchors(it->second);
+            refit = true;
+        }
+        it++;
+    }
+
+    if (refit) {
+        merge_planes();
+    }
+}
+
+void PlaneMap::merge_planes()
+{
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (std::map<int, MapPlane>::iterator a = m_planes.begin(); a != m_planes.end() && !merged; a++) {
+            for (std::map<int, MapPlane>::iterator b = std::next(a); b != m_planes.end() && !merged; b++) {
+                MapPlane &kept = a->second, &other = b->second;
+                if (kept.count < MIN_FIT_POINTS || other.count < MIN_FIT_POINTS) {
+                    continue;
+                }
+
+                const Eigen::Vector3f offset = other.centroid - kept.centroid;
+                if (std::abs(kept.normal.dot(other.normal)) < MERGE_COS_ANGLE ||
+                    std::abs(kept.normal.dot(offset)) > kept.get_reach() ||
+                    std::abs(other.normal.dot(offset)) > other.get_reach()) {
+                    continue;
+                }
+
+                // The sums of both fragments add up to the sums of the merged plane
+                kept.count += other.count;
+                kept.sum += other.sum;
+                kept.sum_squares += other.sum_squares;
+                kept.anchors.insert(kept.anchors.end(), other.anchors.begin(), other.anchors.end());
+                for (std::unordered_map<long, Assignment>::iterator it = m_assignments.begin(); it != m_assignments.end(); it++) {
+                    if (it->second.plane == b->first) {
+                        it->second.plane = a->first;
+                    }
+                }
+
+                m_planes.erase(b);
+                kept.refit();
+                update_anchors(kept);
+                merged = true;
+                std::cout << "[PLANE MAP]: Merged planes, tracking " << m_planes.size() << " planes" << std::endl;
+            }
+        }
+    }
+}
+
+void PlaneMap::update_anchors(MapPlane &plane)
+{
+    // Objects keep their position on the plane, and are moved onto its refit surface
+    for (int i = 0; i < plane.anchors.size(); i++) {
+        Plane* object = plane.anchors[i];
+        Eigen::Vector3f origin = std::get<0>(object->get_plane_information());
+        origin -= plane.normal.dot(origin - plane.centroid) * plane.normal;
+        object->set_plane(origin, plane.normal);
+    }
+}
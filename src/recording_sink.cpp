@@ -0,0 +1,178 @@
+#include "recording_sink.h"
+
+namespace
+{
+
+bool ends_with(const std::string &str, const std::string &suffix)
+{
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // namespace
+
+RecordingSink::RecordingSink(const std::string &path, int width, int height, double fps, size_t queue_capacity, DropPolicy policy) :
+    m_path{path},
+    m_format{format_from_path(path)},
+    m_width{width},
+    m_height{height},
+    m_fps{fps},
+    m_queue{queue_capacity, policy},
+    m_file{nullptr},
+    m_written{0},
+    m_write_ms{0.0}
+{
+    open();
+    m_thread = std::thread(&RecordingSink::run, this);
+}
+
+RecordingSink::~RecordingSink()
+{
+    close();
+}
+
+void RecordingSink::write(int index, const cv::Mat &image)
+{
+    cv::Mat buffer;
+    {
+        std::unique_lock<std::mutex> lock(m_free_mutex);
+        if (!m_free_images.empty()) {
+            buffer = m_free_images.back();
+            m_free_images.pop_back();
+        }
+    }
+    image.copyTo(buffer);
+
+    // A full queue hands the frame straight back, so its buffer is recycled
+    std::optional<RecordedFrame> dropped = m_queue.push({index, buffer});
+    if (dropped) {
+        std::unique_lock<std::mutex> lock(m_free_mutex);
+        m_free_images.push_back(dropped->image);
+    }
+}
+
+void RecordingSink::close()
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+
+    m_queue.close();
+    m_thread.join();
+
+    if (m_video.isOpened()) {
+        m_video.release();
+    }
+    if (m_file) {
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+
+    RecordingStats stats = get_stats();
+    std::cout << "[RECORDING]: Wrote " << stats.written << " frames to " << m_path << ", dropped " << stats.dropped 
+              << " (max queued " << stats.max_queued << ", " << stats.write_ms / std::max(stats.written, 1) << " ms per frame)" << std::endl;
+}
+
+RecordingStats RecordingSink::get_stats()
+{
+    QueueStats queue_stats = m_queue.get_stats();
+    return {m_written, queue_stats.dropped, queue_stats.max_depth, m_write_ms};
+}
+
+RecordingFormat RecordingSink::format_from_path(const std::string &path)
+{
+    if (ends_with(path, ".mp4") || ends_with(path, ".avi") || ends_with(path, ".mkv")) {
+        return RecordingFormat::VIDEO;
+    } else if (ends_with(path, ".y4m")) {
+        return RecordingFormat::Y4M;
+    } else if (ends_with(path, ".bgr")) {
+        return RecordingFormat::RAW;
+    }
+    return RecordingFormat::PNG;
+}
+
+void RecordingSink::run()
+{
+    set_profile_thread_name("Recording");
+
+    RecordedFrame frame;
+    while (m_queue.pop(frame)) {
+        const std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+        {
+            PROFILE_SCOPE("encode");
+            encode(frame);
+        }
+        const std::chrono::time_point<std::chrono::steady_clock> end = std::chrono::steady_clock::now();
+        m_write_ms += std::chrono::duration<double, std::milli>(end - start).count();
+        m_written++;
+
+        std::unique_lock<std::mutex> lock(m_free_mutex);
+        m_free_images.push_back(frame.image);
+    }
+}
+
+void RecordingSink::open()
+{
+    switch (m_format) {
+        case RecordingFormat::VIDEO: {
+            // MJPG is the codec every OpenCV backend can write to an .avi
+            int fourcc = ends_with(m_path, ".avi") ? cv::VideoWriter::fourcc('M', 'J', 'P', 'G') : cv::VideoWriter::fourcc('m', 'p', '4', 'v');
+            if (!m_video.open(m_path, fourcc, m_fps, cv::Size(m_width, m_height))) {
+                throw std::runtime_error("Failed to open video writer for " + m_path);
+            }
+            break;
+        }
+        case RecordingFormat::Y4M: {
+            if ((m_width % 2) || (m_height % 2)) {
+                throw std::runtime_error("Y4M recordings need an even resolution");
+            }
+            m_file = std::fopen(m_path.c_str(), "wb");
+            if (!m_file) {
+                throw std::runtime_error("Failed to open " + m_path);
+            }
+            std::fprintf(m_file, "YUV4MPEG2 W%d H%d F%d:1000 Ip A1:1 C420jpeg\n", m_width, m_height, static_cast<int>(m_fps * 1000));
+            break;
+        }
+        case RecordingFormat::RAW: {
+            m_file = std::fopen(m_path.c_str(), "wb");
+            if (!m_file) {
+                throw std::runtime_error("Failed to open " + m_path);
+            }
+            std::cout << "[RECORDING]: Raw frames are bgr24 at " << m_width << "x" << m_height << std::endl;
+            break;
+        }
+        case RecordingFormat::PNG: {
+            break;
+        }
+    }
+}
+
+void RecordingSink::encode(const RecordedFrame &frame)
+{
+    switch (m_format) {
+        case RecordingFormat::VIDEO: {
+            m_video.write(frame.image);
+            break;
+        }
+        case RecordingFormat::Y4M: {
+            // OpenCV already produces the planar layout Y4M expects
+            cv::cvtColor(frame.image, m_yuv, cv::COLOR_BGR2YUV_I420);
+            std::fputs("FRAME\n", m_file);
+            std::fwrite(m_yuv.data, 1, m_yuv.total(), m_file);
+            break;
+        }
+        case RecordingFormat::RAW: {
+            for (int y = 0; y < frame.image.rows; y++) {
+                std::fwrite(frame.image.ptr<uchar>(y), 1, frame.image.cols * frame.image.elemSize(), m_file);
+            }
+            break;
+        }
+        case RecordingFormat::PNG: {
+            std::string frame_id = std::to_string(frame.index);
+            int padding = 5 - frame_id.length();
+            frame_id.insert(0, std::max(padding, 0), '0');
+            frame_id += ".png";
+            cv::imwrite(m_path + '/' + frame_id, frame.image);
+            break;
+        }
+    }
+}
@@ -1,17 +1,48 @@
 #include "renderer.h"
 
-Renderer::Renderer(size_t width, size_t height, float scale, const std::string &settings, const std::string &shaders, const std::string &model_path) : 
+namespace
+{
+
+// Sampler uniforms, in the order of the texture units they read from
+constexpr UniformName UNIFORM_BACKGROUND_IMAGE("backgroundImage");
+constexpr UniformName UNIFORM_G_POSITION("gPosition");
+constexpr UniformName UNIFORM_G_NORMAL("gNormal");
+constexpr UniformName UNIFORM_G_DIFF_SPEC("gDiffSpec");
+constexpr UniformName UNIFORM_DEPTH_TEXTURE("depthTexture");
+constexpr UniformName UNIFORM_LIGHT_DATA("lightData");
+constexpr UniformName UNIFORM_LIGHT_LISTS("lightLists");
+
+} // namespace
+
+Renderer::Renderer(size_t width, size_t height, float scale, const std::string &settings, const std::string &shaders, const std::string &model_path, FramePool &frame_pool, bool headless) : 
     m_width{width}, 
     m_height{height}, 
+    m_headless{headless},
+    m_output_fbo{0},
     m_camera_settings{settings},
     m_shader_dir{shaders},
+    m_frame_pool{frame_pool},
+    m_pending_frame{nullptr},
+    m_frame{nullptr},
     m_scene{model_path},
+    m_frame_ubo{0},
+    m_light_grid{static_cast<int>(width), static_cast<int>(height), settings},
+    m_depth_buffer_index{0},
     m_image_updated{false},
     m_draw_key_points{false},
     m_add_object{false},
     m_copy_pixel_data{true},
     m_should_close{false},
-    m_last_object_added{nullptr},
+    m_object_added{false},
+    m_readback_next{0},
+    m_readback_pending{0},
+    m_render_wait_ns{0},
+    m_producer_wait_ns{0},
+    m_render_wait_ms{0.0f},
+    m_producer_wait_ms{0.0f},
+    m_timer_frame{0},
+    m_gpu_clock_offset_ns{0},
+    m_gpu_track{-1},
     m_last_frame{std::chrono::system_clock::now()}
 {
     // Most initialization happens when run() is called on a separate thread
@@ -21,52 +52,72 @@ Renderer::Renderer(size_t width, size_t height, float scale, const std::string &
 
 Renderer::~Renderer()
 {
+    m_frame_pool.release(m_frame);
+    m_frame_pool.release(m_pending_frame.exchange(nullptr));
     glfwTerminate();
 }
 
 void Renderer::run()
 {
+    set_profile_thread_name("Render");
+
     init_window();
     init_gl();
     init_framebuffer();
     init_shaders();
     init_images();
     init_scene();
-    init_ui();
-
-    std::unique_lock<std::mutex> render_lock(m_render_mutex, std::defer_lock);
-    std::unique_lock<std::mutex> slam_lock(m_slam_mutex, std::defer_lock);
-    std::unique_lock<std::mutex> image_lock(m_image_mutex, std::defer_lock);
-    std::unique_lock<std::mutex> light_lock(m_light_mutex, std::defer_lock);
-    std::unique_lock<std::mutex> object_lock(m_object_mutex, std::defer_lock);
+    if (!m_headless) {
+        init_ui();
+    }
+    init_timers();
 
     glEnable(GL_CULL_FACE);
     glCullFace(GL_BACK);
     glEnable(GL_DEPTH_TEST); 
     glEnable(GL_MULTISAMPLE);
-    while (!m_should_close)
+    while (m_headless ? wait_for_frame() : !m_should_close)
     {
-        render_lock.lock();
-        slam_lock.lock();
-        image_lock.lock();
-        light_lock.lock();
-        object_lock.lock();
+        // Everything drawn below only touches state owned by the render thread,
+        // so the other threads never have to wait for a frame to finish.
+        update_state();
 
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        if (m_draw_key_points) {
+        if (m_draw_key_points && m_frame) {
             draw_key_points();
         }
         
         draw_background_image();
 
-        if (m_add_object) {
-            Plane* plane = detect_plane(m_map_points, m_key_points, m_camera_pose);
+        // Known planes take on the newly tracked points of every frame
+        if (m_image_updated && m_frame) {
+            PROFILE_SCOPE("update_plane_map");
+            m_plane_map.update(m_frame->tracked_points);
+        }
+
+        if (m_add_object && m_frame) {
+            // Objects are placed on a known plane if one is in view, and only otherwise is a new one detected
+            Plane* plane = m_plane_map.anchor_object(m_frame->tracked_points);
+            if (plane) {
+                std::cout << "[RENDERER]: Object anchored to a known plane" << std::endl;
+            } else {
+                PROFILE_SCOPE("detect_plane");
+                plane = detect_plane(m_frame->tracked_points, m_frame->key_points, m_frame->camera_pose);
+                if (plane) {
+                    m_plane_map.add_plane(plane, m_frame->tracked_points);
+                }
+            }
+
             if (plane) {
                 std::cout << "[RENDERER]: New object added" << std::endl;
                 m_scene.add_object(plane);
-                m_last_object_added = plane;
+
+                // Anchored objects keep moving as their plane is refined, so other threads get a copy
+                std::unique_lock<std::mutex> object_lock = timed_lock(m_object_mutex, m_render_wait_ns);
+                m_last_object_added = plane->get_plane_information();
+                m_object_added = true;
             } else {
                 std::cout << "[RENDERER]: No plane detected to add object" << std::endl;
             }
@@ -81,23 +132,36 @@ void Renderer::run()
         glClear(GL_DEPTH_BUFFER_BIT);
         draw_scene();
 
+        const bool new_frame = m_image_updated;
         m_image_updated = false;
 
-        if (m_copy_pixel_data) {
-            copy_pixel_data();
+        copy_pixel_data();
+
+        // Headless frames are only read back, so there's nothing to present
+        if (!m_headless) {
+            // draw the UI on top of everything else
+            draw_ui();
+
+            PROFILE_SCOPE("swap_buffers");
+            glfwPollEvents();
+            glfwSwapBuffers(m_window);
         }
 
-        // draw the UI on top of everything else
-        draw_ui();
+        // The swap (or readback, when headless) is as close to the photons as we can measure
+        if (m_frame) {
+            m_latency.record_present(*m_frame, new_frame, latency_clock_ns());
+        }
+    }
 
-        render_lock.unlock();
-        slam_lock.unlock();
-        image_lock.unlock();
-        light_lock.unlock();
-        object_lock.unlock();
+    // Headless renders are delivered in full, otherwise readbacks still in flight are abandoned
+    finish_readbacks(m_headless);
+    for (int i = 0; i < m_readback_pending; i++) {
+        glDeleteSync(m_readback_fences[(m_readback_next - m_readback_pending + i + NUM_READBACK_BUFFERS) % NUM_READBACK_BUFFERS]);
+    }
+    m_readback_pending = 0;
 
-        glfwPollEvents();
-        glfwSwapBuffers(m_window);
+    if (m_gpu_track >= 0) {
+        glDeleteQueries(NUM_TIMER_FRAMES * NUM_TIMESTAMPS, &m_timer_queries[0][0]);
     }
 
     glfwSetWindowShouldClose(m_window, GL_TRUE);
@@ -105,64 +169,132 @@ void Renderer::run()
 
 void Renderer::close()
 {
+    std::unique_lock<std::mutex> lock(m_handoff_mutex);
     m_should_close = true;
+    m_handoff.notify_all();
 }
 
-void Renderer::set_slam(const cv::Mat &pose, 
-                        const std::vector<ORB_SLAM3::MapPoint*> &map_points,
-                        const std::vector<cv::KeyPoint> &key_points)
+void Renderer::set_frame(Frame* frame)
 {
-    std::lock_guard<std::mutex> lock(m_slam_mutex);
+    // A headless renderer makes the caller wait until it picked up the previous frame
+    if (m_headless) {
+        std::unique_lock<std::mutex> lock(m_handoff_mutex);
+        m_handoff.wait(lock, [&] { return !m_pending_frame.load() || m_should_close; });
+        m_frame_pool.release(m_pending_frame.exchange(frame, std::memory_order_acq_rel));
+        m_handoff.notify_all();
+        return;
+    }
 
-    m_camera_pose = pose.clone();
-    m_map_points = map_points;
-    m_key_points = key_points;
+    // If the renderer hasn't picked up the previous frame yet, it's dropped
+    Frame* dropped = m_pending_frame.exchange(frame, std::memory_order_acq_rel);
+    m_frame_pool.release(dropped);
+}
+
+void Renderer::set_lights(const std::vector<Light> &lights)
+{
+    m_lights.back() = lights;
+    m_lights.publish();
 }
 
-void Renderer::set_images(const cv::Mat &rgb_image, const cv::Mat &depth_image)
+void Renderer::add_object(const Eigen::Vector3f &origin, const Eigen::Vector3f &normal, float orientation)
 {
-    std::lock_guard<std::mutex> lock(m_image_mutex);
+    Plane* new_object = new Plane(origin, normal, orientation);
 
-    m_background_image = rgb_image.clone();
-    m_completed_depth = depth_image.clone();
-    m_image_updated = true;
+    std::unique_lock<std::mutex> lock = timed_lock(m_object_mutex, m_producer_wait_ns);
+    m_pending_objects.push_back(new_object);
 }
 
-void Renderer::set_lights(const std::vector<Light> &lights)
+bool Renderer::get_most_recent_object(std::tuple<Eigen::Vector3f, Eigen::Vector3f, float> &information)
 {
-    std::lock_guard<std::mutex> lock(m_light_mutex);
+    std::unique_lock<std::mutex> lock = timed_lock(m_object_mutex, m_producer_wait_ns);
 
-    m_lights = lights;
+    if (!m_object_added) {
+        return false;
+    }
+    information = m_last_object_added;
+    m_object_added = false;
+    return true;
 }
 
-void Renderer::add_object(const cv::Mat &origin, const cv::Mat &normal, float orientation)
+cv::Mat Renderer::get_most_recent_frame()
 {
-    std::lock_guard<std::mutex> lock(m_object_mutex);
+    // Ask for another readback, and pick up the newest one that finished
+    m_copy_pixel_data = true;
+    m_images.update();
+    return m_images.front();
+}
 
-    Plane* new_object = new Plane(origin, normal, orientation);
-    m_scene.add_object(new_object);
+void Renderer::set_readback_callback(const std::function<void(int, const cv::Mat&)> &on_readback)
+{
+    m_on_readback = on_readback;
 }
 
-Plane* Renderer::get_most_recent_object()
+bool Renderer::wait_for_frame()
 {
-    std::lock_guard<std::mutex> lock(m_object_mutex);
+    std::unique_lock<std::mutex> lock(m_handoff_mutex);
+    m_handoff.wait(lock, [&] { return m_pending_frame.load() || m_should_close; });
+    return m_pending_frame.load() != nullptr;
+}
 
-    Plane* last_object = m_last_object_added;
-    m_last_object_added = nullptr; 
-    return last_object;
+void Renderer::set_light_range(float light_range)
+{
+    m_light_grid.set_light_range(light_range);
 }
 
-cv::Mat Renderer::get_most_recent_frame()
+bool Renderer::set_latency_csv(const std::string &filepath)
 {
-    std::lock_guard<std::mutex> lock(m_render_mutex);
+    return m_latency.open_csv(filepath);
+}
 
-    m_copy_pixel_data = true;
-    return m_image;
+LatencyMonitor& Renderer::get_latency_monitor()
+{
+    return m_latency;
+}
+
+void Renderer::update_state()
+{
+    PROFILE_SCOPE("update_state");
+    // Swap in the newest frame, and give the one we were drawing back to the pool
+    Frame* newest;
+    if (m_headless) {
+        std::unique_lock<std::mutex> lock(m_handoff_mutex);
+        newest = m_pending_frame.exchange(nullptr, std::memory_order_acq_rel);
+        m_handoff.notify_all();
+    } else {
+        newest = m_pending_frame.exchange(nullptr, std::memory_order_acq_rel);
+    }
+    if (newest) {
+        m_frame_pool.release(m_frame);
+        m_frame = newest;
+        m_image_updated = true;
+    }
+
+    m_lights.update();
+
+    {
+        std::unique_lock<std::mutex> lock = timed_lock(m_object_mutex, m_render_wait_ns);
+        for (int i = 0; i < m_pending_objects.size(); i++) {
+            m_scene.add_object(m_pending_objects[i]);
+        }
+        m_pending_objects.clear();
+    }
+
+    // Keep track of how long each side waited since the last frame
+    m_render_wait_ms = m_render_wait_ns.exchange(0) / 1.0e6f;
+    m_producer_wait_ms = m_producer_wait_ns.exchange(0) / 1.0e6f;
 }
 
 // Initialization helpers
 void Renderer::init_window()
 {
+    // Headless renderers don't need a display server, and use
+    // a software OpenGL context through OSMesa when there's no GPU.
+    if (m_headless) {
+#ifdef GLFW_PLATFORM_NULL
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
+    }
+
     // Initialize and configure GLFW
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -171,6 +303,10 @@ void Renderer::init_window()
 
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
     glfwWindowHint(GLFW_SAMPLES, 4);
+    if (m_headless) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+    }
 
     // Create window and make context current
     m_window = glfwCreateWindow(m_scaled_width, m_scaled_height, "Mixed Reality Demo", NULL, NULL);
@@ -239,6 +375,31 @@ void Renderer::init_framebuffer()
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     std::cout << "[RENDERER]: Geometry framebuffer created" << std::endl;
+
+    // Headless renderers draw the final image into an offscreen framebuffer instead of the window
+    if (m_headless) {
+        glGenFramebuffers(1, &m_output_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_output_fbo);
+
+        unsigned int rbo_color;
+        glGenRenderbuffers(1, &rbo_color);
+        glBindRenderbuffer(GL_RENDERBUFFER, rbo_color);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGB8, m_scaled_width, m_scaled_height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rbo_color);
+
+        unsigned int rbo_output_depth;
+        glGenRenderbuffers(1, &rbo_output_depth);
+        glBindRenderbuffer(GL_RENDERBUFFER, rbo_output_depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, m_scaled_width, m_scaled_height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rbo_output_depth);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "[RENDERER]: Offscreen framebuffer is incomplete" << std::endl;
+        }
+
+        std::cout << "[RENDERER]: Offscreen framebuffer created" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, m_output_fbo);
 }
 
 void Renderer::init_shaders()
@@ -255,6 +416,28 @@ void Renderer::init_shaders()
     m_deferred_shader = Shader(m_shader_dir + "/deferred_vert.glsl", 
                                m_shader_dir + "/deferred_frag.glsl");
 
+    // Samplers always read from the same texture units
+    m_image_shader.use();
+    m_image_shader.set_int(UNIFORM_BACKGROUND_IMAGE, 0);
+    m_deferred_shader.use();
+    m_deferred_shader.set_int(UNIFORM_G_POSITION, 0);
+    m_deferred_shader.set_int(UNIFORM_G_NORMAL, 1);
+    m_deferred_shader.set_int(UNIFORM_G_DIFF_SPEC, 2);
+    m_deferred_shader.set_int(UNIFORM_DEPTH_TEXTURE, 3);
+    m_deferred_shader.set_int(UNIFORM_LIGHT_DATA, 4);
+    m_deferred_shader.set_int(UNIFORM_LIGHT_LISTS, 5);
+    glUseProgram(0);
+    m_light_grid.init_buffers();
+
+    // Per-frame data is written to a single buffer, which all programs read from
+    glGenBuffers(1, &m_frame_ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_frame_ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, m_frame_ubo);
+    m_geometry_shader.bind_uniform_block("FrameData", FRAME_UNIFORMS_BINDING);
+    m_deferred_shader.bind_uniform_block("FrameData", FRAME_UNIFORMS_BINDING);
+
     std::cout << "[RENDERER]: Shaders compiled and linked" << std::endl;
 }
 
@@ -274,13 +457,29 @@ void Renderer::init_images()
     glGenTextures(1, &m_depth_texture);
     glBindTexture(GL_TEXTURE_2D, m_depth_texture);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, m_width, m_height, 0, GL_RED, GL_FLOAT, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, m_width, m_height, 0, GL_RED, GL_HALF_FLOAT, 0);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
     std::vector<GLfloat> empty_depth(m_width * m_height, 1.0f);
     glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RED, GL_FLOAT, empty_depth.data());
 
+    // Pixel buffers that depth is streamed through
+    glGenBuffers(NUM_DEPTH_BUFFERS, m_depth_buffers);
+    for (int i = 0; i < NUM_DEPTH_BUFFERS; i++) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_depth_buffers[i]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, m_width * m_height * sizeof(GLhalf), nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // Pixel buffers that rendered frames are read back through
+    glGenBuffers(NUM_READBACK_BUFFERS, m_readback_buffers);
+    for (int i = 0; i < NUM_READBACK_BUFFERS; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_readback_buffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 3 * m_scaled_width * m_scaled_height, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
     // Draw a screen quad to sample the background image
     glGenVertexArrays(1, &m_quad_vao);
     glBindVertexArray(m_quad_vao);
@@ -327,45 +526,121 @@ void Renderer::init_ui()
     std::cout << "[RENDERER]: UI initialized" << std::endl;
 }
 
+void Renderer::init_timers()
+{
+    for (int i = 0; i < NUM_TIMER_FRAMES; i++) {
+        m_timer_pending[i] = false;
+    }
+
+    // Like the CPU scopes, the GPU timers are compiled out along with the rest of the profiling
+#ifdef MIXED_REALITY_PROFILING
+    if (!profiling_enabled()) {
+        return;
+    }
+
+    glGenQueries(NUM_TIMER_FRAMES * NUM_TIMESTAMPS, &m_timer_queries[0][0]);
+    m_gpu_track = add_profile_track("GPU");
+
+    // GPU timestamps are moved onto the CPU timeline, so both line up in the trace
+    GLint64 gpu_ns;
+    glGetInteger64v(GL_TIMESTAMP, &gpu_ns);
+    m_gpu_clock_offset_ns = profile_clock_ns() - gpu_ns;
+#endif
+}
+
 // Renderer drawing helpers
 void Renderer::draw_key_points()
 {
-    for (int i = 0; i < m_key_points.size(); i++)
+    PROFILE_SCOPE("draw_key_points");
+    for (int i = 0; i < m_frame->key_points.size(); i++)
     {
-        if (m_map_points[i])
+        if (m_frame->tracked_points[i].id >= 0)
         {
-            cv::circle(m_background_image, m_key_points[i].pt, 2, cv::Scalar(0, 255, 0), -1);
+            cv::circle(m_frame->rgb_image, m_frame->key_points[i].pt, 2, cv::Scalar(0, 255, 0), -1);
         }
     }
 }
 
 void Renderer::draw_background_image() 
 {
+    PROFILE_SCOPE("draw_background_image");
     glViewport(0, 0, m_scaled_width, m_scaled_height);
 
     // Get the most recently updated image if it changed
     if (m_image_updated) {
         glBindTexture(GL_TEXTURE_2D, m_background_texture);
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_BGR, GL_UNSIGNED_BYTE, m_background_image.data);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_BGR, GL_UNSIGNED_BYTE, m_frame->rgb_image.data);
     }
 
     // The background image is drawn directly to the screen framebuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_output_fbo);
     m_image_shader.use();
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, m_background_texture);
-    m_image_shader.set_int("backgroundImage", 0);
     glBindVertexArray(m_quad_vao);
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr);
 }
 
+void Renderer::upload_depth()
+{
+    PROFILE_SCOPE("upload_depth");
+    // Each upload goes through the next buffer in the ring, and its storage is orphaned first
+    // so that mapping never waits for a transfer the GPU hasn't finished reading yet.
+    m_depth_buffer_index = (m_depth_buffer_index + 1) % NUM_DEPTH_BUFFERS;
+    const GLsizeiptr size = m_width * m_height * sizeof(GLhalf);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_depth_buffers[m_depth_buffer_index]);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (mapped) {
+        // OpenCV converts to half floats with vector instructions (F16C or NEON)
+        cv::Mat half_depth(m_height, m_width, CV_16FC1, mapped);
+        m_frame->completed_depth.convertTo(half_depth, CV_16F);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        // With a pixel buffer bound, the data pointer is an offset into it
+        glBindTexture(GL_TEXTURE_2D, m_depth_texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RED, GL_HALF_FLOAT, nullptr);
+    } else {
+        std::cerr << "[RENDERER]: Failed to map the depth upload buffer" << std::endl;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void Renderer::update_frame_uniforms()
+{
+    m_frame_uniforms.view = glm_from_eigen(m_frame->camera_pose);
+    m_frame_uniforms.persp = m_persp;
+    const Eigen::Vector3f view_position = camera_center(m_frame->camera_pose);
+    m_frame_uniforms.view_position = glm::vec3(view_position(0), view_position(1), view_position(2));
+
+    // Lights are binned for the depth of the newest frame, as seen from its pose
+    {
+        PROFILE_SCOPE("cull_lights");
+        if (m_image_updated) {
+            m_light_grid.set_depth(m_frame->completed_depth);
+        }
+        m_light_grid.cull(m_lights.front(), m_frame->camera_pose);
+    }
+    m_frame_uniforms.light_tile_size = LightGrid::TILE_SIZE;
+    m_frame_uniforms.light_tile_count = glm::ivec2(m_light_grid.get_tiles_x(), m_light_grid.get_tiles_y());
+    m_frame_uniforms.image_size = glm::vec2(m_width, m_height);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, m_frame_ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &m_frame_uniforms);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
 void Renderer::draw_scene()
 {
-    if (m_camera_pose.empty()) {
+    PROFILE_SCOPE("draw_scene");
+    if (!m_frame) {
         return;
     }
 
     // Render objects at 2x resolution
+    read_timestamps();
+    write_timestamp(0);
     glViewport(0, 0, 2 * m_width, 2 * m_height);
 
     // First draw to a geometry buffer
@@ -375,51 +650,41 @@ void Renderer::draw_scene()
     glClearColor(0.0f, 0.0f, 0.0f, 10.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // First bind the view and perspective matrices;
-    // only the model matrix changes between objects
+    // Everything that changes once per frame is uploaded in one go
+    update_frame_uniforms();
     m_geometry_shader.use();
-
-    m_geometry_shader.set_mat4("persp", m_persp);
-    m_geometry_shader.set_mat4("view", glm_from_cv(m_camera_pose));
-
     m_scene.draw(m_geometry_shader);
+    write_timestamp(1);
 
     // Then render at scaled resolution
     glViewport(0, 0, m_scaled_width, m_scaled_height);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_output_fbo);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, m_positions);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, m_normals);
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_2D, m_diff_spec);
+    glActiveTexture(GL_TEXTURE3);
     if (m_image_updated) {
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, m_depth_texture);
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RED, GL_FLOAT, m_completed_depth.data);
+        upload_depth();
     }
-    glActiveTexture(GL_TEXTURE3);
     glBindTexture(GL_TEXTURE_2D, m_depth_texture);
+    m_light_grid.upload(GL_TEXTURE4, GL_TEXTURE5);
 
     m_deferred_shader.use();
-    m_deferred_shader.set_int("gPosition", 0);
-    m_deferred_shader.set_int("gNormal", 1);
-    m_deferred_shader.set_int("gDiffSpec", 2);
-    m_deferred_shader.set_int("depthTexture", 3);
-
-    for (int i = 0; i < m_lights.size(); i++) {
-        m_deferred_shader.set_vec3("lights[" + std::to_string(i) + "].position", m_lights[i].position);
-        m_deferred_shader.set_vec3("lights[" + std::to_string(i) + "].color", m_lights[i].color);
-        m_deferred_shader.set_float("lights[" + std::to_string(i) + "].intensity", m_lights[i].intensity);
-    }
-
     glBindVertexArray(m_quad_vao);
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr);
+    write_timestamp(2);
+
+    m_timer_pending[m_timer_frame] = (m_gpu_track >= 0);
+    m_timer_frame = (m_timer_frame + 1) % NUM_TIMER_FRAMES;
 }
 
 void Renderer::draw_ui()
 {
+    PROFILE_SCOPE("draw_ui");
     static int counter = 0;
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
@@ -437,6 +702,13 @@ void Renderer::draw_ui()
     ImGui::NewLine();
     ImGui::Text("%.3f ms/frame (%.1f FPS)", 
                 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+    ImGui::Text("Lock wait: %.3f ms render, %.3f ms producers", m_render_wait_ms, m_producer_wait_ms);
+    ImGui::Text("Lights: %d, %.1f per tile on average, %d at most, %d dropped from full tiles", m_light_grid.get_light_count(),
+                m_light_grid.get_average_tile_lights(), m_light_grid.get_max_tile_lights(), m_light_grid.get_dropped_tile_lights());
+
+    // Latencies are measured from when the camera frame was captured
+    ImGui::NewLine();
+    m_latency.draw_ui();
 
     ImGui::End();
     ImGui::Render();
@@ -448,16 +720,114 @@ void Renderer::draw_ui()
 // because OpenGL functions are called
 void Renderer::copy_pixel_data()
 {
-    // Make sure rendering is finished first
-    glFinish();
+    PROFILE_SCOPE("copy_pixel_data");
+    // With a readback callback, every frame is read back. A headless renderer
+    // waits for the oldest readback when the ring is full instead of skipping one.
+    bool requested = m_copy_pixel_data || m_on_readback;
+    if (requested && m_headless && m_readback_pending == NUM_READBACK_BUFFERS) {
+        finish_oldest_readback(std::numeric_limits<GLuint64>::max());
+    }
 
-    // Copy the buffer data to a cv::Mat
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    m_image = cv::Mat(m_scaled_height, m_scaled_width, CV_8UC3);
-    glPixelStorei(GL_PACK_ALIGNMENT, (m_image.step & 3) ? 1 : 4);
-    glPixelStorei(GL_PACK_ROW_LENGTH, m_image.step/m_image.elemSize());
-    glReadBuffer(GL_BACK);
-    glReadPixels(0, 0, m_scaled_width, m_scaled_height, GL_BGR, GL_UNSIGNED_BYTE, m_image.data);
-    cv::flip(m_image, m_image, 0);
-    m_copy_pixel_data = false;
-}
\ No newline at end of file
+    // Start reading this frame into the next buffer of the ring. The copy happens
+    // on the GPU, and a fence marks when it's done. If every buffer is still in
+    // flight, the request waits for a later frame instead of stalling this one.
+    if (requested && m_readback_pending < NUM_READBACK_BUFFERS) {
+        glBindFramebuffer(GL_FRAMEBUFFER, m_output_fbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_readback_buffers[m_readback_next]);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+        glReadBuffer(m_headless ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+        glReadPixels(0, 0, m_scaled_width, m_scaled_height, GL_BGR, GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        m_readback_fences[m_readback_next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        m_readback_indices[m_readback_next] = m_frame ? m_frame->index : -1;
+        m_readback_next = (m_readback_next + 1) % NUM_READBACK_BUFFERS;
+        m_readback_pending++;
+        m_copy_pixel_data = false;
+    }
+
+    finish_readbacks(false);
+}
+
+void Renderer::finish_readbacks(bool wait)
+{
+    // Map every readback the GPU has already finished, oldest first
+    const GLuint64 timeout_ns = wait ? std::numeric_limits<GLuint64>::max() : 0;
+    while (m_readback_pending > 0) {
+        if (!finish_oldest_readback(timeout_ns)) {
+            break;
+        }
+    }
+}
+
+bool Renderer::finish_oldest_readback(GLuint64 timeout_ns)
+{
+    // Flushing makes sure the fence is eventually reached, even without swapping buffers
+    int oldest = (m_readback_next - m_readback_pending + NUM_READBACK_BUFFERS) % NUM_READBACK_BUFFERS;
+    GLenum status = glClientWaitSync(m_readback_fences[oldest], GL_SYNC_FLUSH_COMMANDS_BIT, timeout_ns);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+        return false;
+    }
+    glDeleteSync(m_readback_fences[oldest]);
+    m_readback_pending--;
+
+    const size_t row_size = 3 * m_scaled_width;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_readback_buffers[oldest]);
+    const GLubyte* pixels = static_cast<const GLubyte*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, row_size * m_scaled_height, GL_MAP_READ_BIT));
+    if (pixels) {
+        // OpenGL rows start at the bottom, so the image is flipped while it's copied out
+        cv::Mat &image = m_images.back();
+        image.create(m_scaled_height, m_scaled_width, CV_8UC3);
+        for (size_t y = 0; y < m_scaled_height; y++) {
+            std::memcpy(image.ptr<uchar>(m_scaled_height - 1 - y), pixels + y * row_size, row_size);
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+        if (m_on_readback) {
+            m_on_readback(m_readback_indices[oldest], image);
+        } else {
+            m_images.publish();
+        }
+    } else {
+        std::cerr << "[RENDERER]: Failed to map the readback buffer" << std::endl;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    return true;
+}
+
+void Renderer::write_timestamp(int stamp)
+{
+#ifdef MIXED_REALITY_PROFILING
+    if (m_gpu_track >= 0) {
+        glQueryCounter(m_timer_queries[m_timer_frame][stamp], GL_TIMESTAMP);
+    }
+#endif
+}
+
+void Renderer::read_timestamps()
+{
+#ifdef MIXED_REALITY_PROFILING
+    if (!m_timer_pending[m_timer_frame]) {
+        return;
+    }
+    m_timer_pending[m_timer_frame] = false;
+
+    // Queries finish in order, so once the last one is available all of them are.
+    // If the GPU is still that far behind, the frame's timings are skipped rather than waited for.
+    GLuint* queries = m_timer_queries[m_timer_frame];
+    GLint available = 0;
+    glGetQueryObjectiv(queries[NUM_TIMESTAMPS - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return;
+    }
+
+    GLuint64 timestamps[NUM_TIMESTAMPS];
+    for (int i = 0; i < NUM_TIMESTAMPS; i++) {
+        glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &timestamps[i]);
+    }
+    record_profile_event("geometry_pass", timestamps[0] + m_gpu_clock_offset_ns, timestamps[1] - timestamps[0], m_gpu_track);
+    record_profile_event("deferred_pass", timestamps[1] + m_gpu_clock_offset_ns, timestamps[2] - timestamps[1], m_gpu_track);
+#endif
+}
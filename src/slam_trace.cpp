@@ -0,0 +1,186 @@
+#include "slam_trace.h"
+
+namespace
+{
+
+const char TRACE_MAGIC[8] = "MRTRACE";
+const uint32_t TRACE_VERSION = 1;
+
+bool host_is_little_endian()
+{
+    const uint16_t probe = 1;
+    uint8_t first_byte;
+    std::memcpy(&first_byte, &probe, 1);
+    return first_byte == 1;
+}
+
+// Values are converted to and from little-endian byte by byte, which
+// also covers floats and doubles on the IEEE 754 hosts we run on
+template <typename T>
+void write_value(std::ofstream &file, const T &value)
+{
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    if (!host_is_little_endian()) {
+        std::reverse(bytes, bytes + sizeof(T));
+    }
+    file.write(bytes, sizeof(T));
+}
+
+template <typename T>
+void read_value(std::ifstream &file, T &value)
+{
+    char bytes[sizeof(T)];
+    file.read(bytes, sizeof(T));
+    if (!host_is_little_endian()) {
+        std::reverse(bytes, bytes + sizeof(T));
+    }
+    std::memcpy(&value, bytes, sizeof(T));
+}
+
+} // namespace
+
+SlamTraceWriter::SlamTraceWriter(const std::string &filepath) :
+    m_file{filepath, std::ios::binary},
+    m_frames{0}
+{
+    if (!m_file.is_open()) {
+        throw std::runtime_error("Failed to open " + filepath);
+    }
+
+    m_file.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    write_value(m_file, TRACE_VERSION);
+}
+
+SlamTraceWriter::~SlamTraceWriter()
+{
+    std::cout << "[SLAM TRACE]: Recorded " << m_frames << " frames" << std::endl;
+}
+
+void SlamTraceWriter::write(const Frame &frame)
+{
+    write_value(m_file, static_cast<int32_t>(frame.index));
+    write_value(m_file, frame.timestamp);
+    write_value(m_file, static_cast<int32_t>(frame.tracking_state));
+
+    // Poses are always 4x4, written row by row
+    for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 4; c++) {
+            write_value(m_file, frame.camera_pose(r, c));
+        }
+    }
+
+    write_value(m_file, static_cast<uint32_t>(frame.key_points.size()));
+    for (int i = 0; i < frame.key_points.size(); i++) {
+        const cv::KeyPoint &key_point = frame.key_points[i];
+        const TrackedPoint &point = frame.tracked_points[i];
+        write_value(m_file, key_point.pt.x);
+        write_value(m_file, key_point.pt.y);
+        write_value(m_file, key_point.size);
+        write_value(m_file, key_point.angle);
+        write_value(m_file, key_point.response);
+        write_value(m_file, static_cast<int32_t>(key_point.octave));
+        write_value(m_file, static_cast<int64_t>(point.id));
+        write_value(m_file, point.position.x);
+        write_value(m_file, point.position.y);
+        write_value(m_file, point.position.z);
+        write_value(m_file, static_cast<int32_t>(point.observations));
+        write_value(m_file, static_cast<uint8_t>(point.bad));
+    }
+
+    m_frames++;
+}
+
+SlamTraceReader::SlamTraceReader(const std::string &filepath) :
+    m_file{filepath, std::ios::binary},
+    m_next_index{-1},
+    m_done{false}
+{
+    if (!m_file.is_open()) {
+        throw std::runtime_error("Failed to open " + filepath);
+    }
+
+    char magic[sizeof(TRACE_MAGIC)];
+    uint32_t version;
+    m_file.read(magic, sizeof(magic));
+    read_value(m_file, version);
+    if (!m_file || std::string(magic) != TRACE_MAGIC || version != TRACE_VERSION) {
+        throw std::runtime_error(filepath + " is not a SLAM trace");
+    }
+
+    read_index();
+}
+
+bool SlamTraceReader::read(Frame &frame)
+{
+    // Skip over any records before this frame
+    while (!m_done && m_next_index < frame.index) {
+        read_record(m_skipped);
+    }
+    if (m_done || m_next_index != frame.index) {
+        return false;
+    }
+
+    read_record(frame);
+    return true;
+}
+
+void SlamTraceReader::read_record(Frame &frame)
+{
+    int32_t tracking_state;
+    read_value(m_file, frame.timestamp);
+    read_value(m_file, tracking_state);
+    frame.tracking_state = tracking_state;
+
+    for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 4; c++) {
+            read_value(m_file, frame.camera_pose(r, c));
+        }
+    }
+
+    uint32_t num_points;
+    read_value(m_file, num_points);
+    frame.key_points.resize(num_points);
+    frame.tracked_points.resize(num_points);
+    for (uint32_t i = 0; i < num_points; i++) {
+        cv::KeyPoint &key_point = frame.key_points[i];
+        TrackedPoint &point = frame.tracked_points[i];
+        int32_t octave, observations;
+        int64_t id;
+        uint8_t bad;
+        read_value(m_file, key_point.pt.x);
+        read_value(m_file, key_point.pt.y);
+        read_value(m_file, key_point.size);
+        read_value(m_file, key_point.angle);
+        read_value(m_file, key_point.response);
+        read_value(m_file, octave);
+        read_value(m_file, id);
+        read_value(m_file, point.position.x);
+        read_value(m_file, point.position.y);
+        read_value(m_file, point.position.z);
+        read_value(m_file, observations);
+        read_value(m_file, bad);
+        key_point.octave = octave;
+        key_point.class_id = -1;
+        point.id = id;
+        point.observations = observations;
+        point.bad = bad;
+    }
+
+    if (!m_file) {
+        throw std::runtime_error("SLAM trace is truncated");
+    }
+
+    read_index();
+}
+
+void SlamTraceReader::read_index()
+{
+    int32_t index;
+    read_value(m_file, index);
+    if (!m_file) {
+        m_done = true;
+    } else {
+        m_next_index = index;
+    }
+}
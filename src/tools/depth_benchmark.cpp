@@ -0,0 +1,137 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "camera_stream.h"
+#include "depth_completion.h"
+#include "util/camera_util.h"
+
+// Errors of a completer against the offline depths, in meters
+struct DepthErrors
+{
+    double abs_sum = 0.0;
+    double squared_sum = 0.0;
+    long within_5cm = 0;
+    long count = 0;
+
+    void add(float error)
+    {
+        abs_sum += std::abs(error);
+        squared_sum += error * error;
+        within_5cm += (std::abs(error) < 0.05f);
+        count++;
+    }
+
+    void print(const std::string &name) const
+    {
+        if (count == 0) {
+            std::cout << "  " << name << ": no pixels" << std::endl;
+            return;
+        }
+        std::cout << "  " << name << ": MAE " << abs_sum / count << " m"
+                  << ", RMSE " << std::sqrt(squared_sum / count) << " m"
+                  << ", within 5cm " << 100.0 * within_5cm / count << "%" << std::endl;
+    }
+};
+
+struct CompleterResult
+{
+    std::string name;
+    DepthCompleter* completer;
+    DepthErrors holes;
+    DepthErrors overall;
+    double total_ms = 0.0;
+};
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        std::cerr << "Usage: ./depth_benchmark [ETH3D|ScanNet] [dataset_dir] [max_frames]" << std::endl;
+        return -1;
+    }
+
+    std::string dataset = argv[1];
+    OfflineDatasetType type;
+    if (dataset == "ETH3D") {
+        type = OfflineDatasetType::ETH3D;
+    } else if (dataset == "ScanNet") {
+        type = OfflineDatasetType::SCANNET;
+    } else {
+        std::cerr << "Invalid dataset type provided" << std::endl;
+        return -1;
+    }
+
+    // The precomputed offline depths serve as ground truth
+    std::string dataset_dir = argv[2];
+    OfflineCameraStream camera(dataset_dir, type);
+    OfflineDepthCompleter ground_truth(dataset_dir, "table3-ctrl_", type);
+
+    int max_frames = camera.get_frame_count();
+    if (argc > 3) {
+        max_frames = std::min(max_frames, std::stoi(argv[3]));
+    }
+
+    std::vector<CompleterResult> results;
+    results.push_back({"morphological", new MorphologicalDepthCompleter(type)});
+    results.push_back({"guided", new GuidedDepthCompleter(type)});
+
+    // Images are resized to the dataset resolution, like the pipeline does before completion
+    const cv::Size size(camera.get_width(), camera.get_height());
+    cv::Mat rgb_image, depth_image;
+
+    const float scale = 1 / 5000.0f;
+    int skipped = 0;
+    for (int i = 0; i < max_frames; i++) {
+        std::tuple<cv::Mat, cv::Mat, double> stream = camera.get_stream();
+        cv::resize(std::get<0>(stream), rgb_image, size);
+        cv::resize(std::get<1>(stream), depth_image, size);
+
+        // Frames without an offline depth can't be compared
+        ground_truth.set_frame_index(i);
+        ground_truth.complete_depth_image(rgb_image, depth_image);
+        const cv::Mat &expected = ground_truth.get_depth_image();
+        if (expected.empty()) {
+            skipped++;
+            continue;
+        }
+
+        for (CompleterResult &result : results) {
+            auto start = std::chrono::steady_clock::now();
+            result.completer->complete_depth_image(rgb_image, depth_image);
+            auto end = std::chrono::steady_clock::now();
+            result.total_ms += std::chrono::duration<double, std::milli>(end - start).count();
+
+            const cv::Mat &completed = result.completer->get_depth_image();
+            for (int y = 0; y < depth_image.rows; y++) {
+                const ushort* raw = depth_image.ptr<ushort>(y);
+                const float* actual = completed.ptr<float>(y);
+                const float* target = expected.ptr<float>(y);
+                for (int x = 0; x < depth_image.cols; x++) {
+                    float error = actual[x] - target[x];
+                    result.overall.add(error);
+                    if (raw[x] * scale <= 0.1f) {
+                        result.holes.add(error);
+                    }
+                }
+            }
+        }
+    }
+
+    const int compared = max_frames - skipped;
+    std::cout << "Compared " << compared << " frames against the offline depths, skipped " << skipped
+              << " without one" << std::endl;
+    for (CompleterResult &result : results) {
+        std::cout << result.name << ": " << result.total_ms / std::max(compared, 1) << " ms/frame" << std::endl;
+        result.holes.print("holes");
+        result.overall.print("overall");
+        delete result.completer;
+    }
+
+    return 0;
+}
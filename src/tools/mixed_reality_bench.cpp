@@ -0,0 +1,486 @@
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "camera_stream.h"
+#include "depth_completion.h"
+#include "estimation_executor.h"
+#include "light_culling.h"
+#include "light_estimation.h"
+#include "util/camera_util.h"
+#include "util/geometry_util.h"
+#include "util/matrix_util.h"
+#include "util/thread_pool.h"
+
+// Benchmarks for every per-frame stage of the pipeline. The inputs are either
+// synthetic or bundled with the repository, so results are comparable across
+// machines and commits. Use --benchmark_out=<file> --benchmark_out_format=json
+// to keep results around for regression tracking.
+
+namespace
+{
+
+const std::string SOURCE_DIR = MIXED_REALITY_SOURCE_DIR;
+const std::string ETH3D_SETTINGS = SOURCE_DIR + "/examples/configs/ETH3D.yaml";
+const std::string CUBE_MODEL = SOURCE_DIR + "/examples/cube/cube.gltf";
+
+const int WIDTH = 736;
+const int HEIGHT = 456;
+const int DATASET_FRAMES = 16;
+
+// Synthetic RGB-D frame: a smooth gradient with a few objects in front of a
+// tilted floor, and depth holes similar to what a real sensor produces.
+void make_synthetic_frame(int seed, cv::Mat &rgb, cv::Mat &raw_depth)
+{
+    cv::RNG rng(seed);
+
+    rgb.create(HEIGHT, WIDTH, CV_8UC3);
+    raw_depth.create(HEIGHT, WIDTH, CV_16UC1);
+    for (int y = 0; y < HEIGHT; y++) {
+        cv::Vec3b* rgb_row = rgb.ptr<cv::Vec3b>(y);
+        ushort* depth_row = raw_depth.ptr<ushort>(y);
+        for (int x = 0; x < WIDTH; x++) {
+            rgb_row[x] = cv::Vec3b(x * 255 / WIDTH, y * 255 / HEIGHT, 128);
+            // ETH3D stores depth in units of 1/5000 m
+            depth_row[x] = static_cast<ushort>(5000.0f * (1.0f + 3.0f * y / HEIGHT));
+        }
+    }
+
+    for (int i = 0; i < 8; i++) {
+        cv::Point center(rng.uniform(0, WIDTH), rng.uniform(0, HEIGHT));
+        int radius = rng.uniform(10, 60);
+        cv::circle(rgb, center, radius, cv::Scalar(rng.uniform(0, 255), rng.uniform(0, 255), rng.uniform(0, 255)), cv::FILLED);
+        cv::circle(raw_depth, center, radius, cv::Scalar(rng.uniform(3000, 8000)), cv::FILLED);
+    }
+
+    for (int i = 0; i < 40; i++) {
+        cv::Point corner(rng.uniform(0, WIDTH), rng.uniform(0, HEIGHT));
+        cv::Point size(rng.uniform(2, 40), rng.uniform(2, 20));
+        cv::rectangle(raw_depth, cv::Rect(corner, corner + size), cv::Scalar(0), cv::FILLED);
+    }
+}
+
+void make_synthetic_depth(const cv::Mat &raw_depth, cv::Mat &depth)
+{
+    raw_depth.convertTo(depth, CV_32F, 1.0f / 5000.0f);
+}
+
+// A small ETH3D-style dataset on disk, created once and shared by all benchmarks
+class SyntheticDataset
+{
+private:
+    std::string m_dir;
+
+public:
+    SyntheticDataset()
+    {
+        m_dir = (std::filesystem::temp_directory_path() / "mixed_reality_bench_dataset").string();
+        std::filesystem::create_directories(m_dir + "/rgb");
+        std::filesystem::create_directories(m_dir + "/depth");
+        std::filesystem::create_directories(m_dir + "/table3-ctrl_depth");
+
+        std::ofstream associations(m_dir + "/associated.txt");
+        for (int i = 0; i < DATASET_FRAMES; i++) {
+            cv::Mat rgb, raw_depth;
+            make_synthetic_frame(i, rgb, raw_depth);
+
+            std::string name = std::to_string(i) + ".png";
+            cv::imwrite(m_dir + "/rgb/" + name, rgb);
+            cv::imwrite(m_dir + "/depth/" + name, raw_depth);
+
+            // The offline completions have no holes
+            cv::Mat filled;
+            cv::medianBlur(raw_depth, filled, 5);
+            cv::max(filled, 5000, filled);
+            cv::imwrite(m_dir + "/table3-ctrl_depth/" + name, filled);
+
+            double t = i / 20.0;
+            associations << t << " rgb/" << name << " " << t << " depth/" << name << "\n";
+        }
+    }
+
+    ~SyntheticDataset()
+    {
+        std::error_code error;
+        std::filesystem::remove_all(m_dir, error);
+    }
+
+    const std::string& get_dir() const
+    {
+        return m_dir;
+    }
+};
+
+const SyntheticDataset& get_dataset()
+{
+    static SyntheticDataset dataset;
+    return dataset;
+}
+
+// Tracked points on a noisy floor plane with some outliers, as SLAM would report them
+void make_synthetic_map(int num_points, std::vector<TrackedPoint> &map_points, std::vector<cv::KeyPoint> &key_points)
+{
+    cv::RNG rng(7);
+    map_points.resize(num_points);
+    key_points.resize(num_points);
+    for (int i = 0; i < num_points; i++) {
+        TrackedPoint &point = map_points[i];
+        point.id = i;
+        point.observations = rng.uniform(6, 30);
+        point.bad = false;
+
+        float x = rng.uniform(-1.0f, 1.0f);
+        float z = rng.uniform(1.0f, 3.0f);
+        float y = (i % 5 == 0) ? rng.uniform(-1.0f, 1.0f) : 0.5f + 0.2f * z + static_cast<float>(rng.gaussian(0.005));
+        point.position = cv::Point3f(x, y, z);
+        key_points[i] = cv::KeyPoint(rng.uniform(0.0f, (float) WIDTH), rng.uniform(0.0f, (float) HEIGHT), 7.0f);
+        key_points[i].response = rng.uniform(0.0f, 100.0f);
+    }
+}
+
+void BM_LoadOfflineDataset(benchmark::State &state)
+{
+    const std::string &dir = get_dataset().get_dir();
+    for (auto _ : state) {
+        std::vector<std::tuple<std::string, std::string, double>> frames = load_offline_dataset(dir, OfflineDatasetType::ETH3D);
+        benchmark::DoNotOptimize(frames.data());
+    }
+}
+BENCHMARK(BM_LoadOfflineDataset)->Unit(benchmark::kMicrosecond);
+
+void BM_OfflineCameraStream(benchmark::State &state)
+{
+    const std::string &dir = get_dataset().get_dir();
+    for (auto _ : state) {
+        OfflineCameraStream camera(dir, OfflineDatasetType::ETH3D);
+        benchmark::DoNotOptimize(camera.get_frame_count());
+    }
+}
+BENCHMARK(BM_OfflineCameraStream)->Unit(benchmark::kMicrosecond);
+
+// Arg is the number of decoder threads, 0 decodes synchronously
+void BM_DecodeFrames(benchmark::State &state)
+{
+    const std::string &dir = get_dataset().get_dir();
+    for (auto _ : state) {
+        state.PauseTiming();
+        OfflineCameraStream camera(dir, OfflineDatasetType::ETH3D, state.range(0));
+        state.ResumeTiming();
+
+        for (int i = 0; i < camera.get_frame_count(); i++) {
+            std::tuple<cv::Mat, cv::Mat, double> stream = camera.get_stream();
+            benchmark::DoNotOptimize(std::get<0>(stream).data);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * DATASET_FRAMES);
+}
+BENCHMARK(BM_DecodeFrames)->Arg(0)->Arg(2)->Arg(4)->Unit(benchmark::kMillisecond);
+
+void run_completer(benchmark::State &state, DepthCompleter &completer)
+{
+    cv::Mat rgb, raw_depth, depth;
+    make_synthetic_frame(0, rgb, raw_depth);
+    make_synthetic_depth(raw_depth, depth);
+
+    for (auto _ : state) {
+        completer.complete_depth_image(rgb, depth);
+        benchmark::DoNotOptimize(completer.get_depth_image().data);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// The completer steps through the dataset, so it's rebuilt whenever it runs out of depth images
+void BM_OfflineDepthCompleter(benchmark::State &state)
+{
+    cv::Mat rgb, raw_depth, depth;
+    make_synthetic_frame(0, rgb, raw_depth);
+    make_synthetic_depth(raw_depth, depth);
+
+    const std::string &dir = get_dataset().get_dir();
+    std::unique_ptr<OfflineDepthCompleter> completer;
+    int frame = 0;
+    for (auto _ : state) {
+        if (frame % DATASET_FRAMES == 0) {
+            state.PauseTiming();
+            completer = std::make_unique<OfflineDepthCompleter>(dir, "table3-ctrl_", OfflineDatasetType::ETH3D);
+            state.ResumeTiming();
+        }
+        frame++;
+
+        completer->complete_depth_image(rgb, depth);
+        benchmark::DoNotOptimize(completer->get_depth_image().data);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_OfflineDepthCompleter)->Unit(benchmark::kMillisecond);
+
+void BM_MorphologicalDepthCompleter(benchmark::State &state)
+{
+    MorphologicalDepthCompleter completer(OfflineDatasetType::ETH3D);
+    run_completer(state, completer);
+}
+BENCHMARK(BM_MorphologicalDepthCompleter)->Unit(benchmark::kMillisecond);
+
+void BM_GuidedDepthCompleter(benchmark::State &state)
+{
+    GuidedDepthCompleter completer(OfflineDatasetType::ETH3D);
+    run_completer(state, completer);
+}
+BENCHMARK(BM_GuidedDepthCompleter)->Unit(benchmark::kMillisecond);
+
+// With a steady tracked pose, most frames reuse the previous completion
+void BM_TemporalDepthCompleter(benchmark::State &state)
+{
+    MorphologicalDepthCompleter inner(OfflineDatasetType::ETH3D);
+    TemporalDepthCompleter completer(inner, OfflineDatasetType::ETH3D, ETH3D_SETTINGS);
+    completer.set_camera_pose(Eigen::Matrix4f::Identity(), true);
+    run_completer(state, completer);
+}
+BENCHMARK(BM_TemporalDepthCompleter)->Unit(benchmark::kMillisecond);
+
+template <typename Estimator>
+void BM_LightEstimator(benchmark::State &state)
+{
+    cv::Mat rgb, raw_depth, depth;
+    make_synthetic_frame(0, rgb, raw_depth);
+    make_synthetic_depth(raw_depth, depth);
+
+    Estimator estimator(state.range(0));
+    for (auto _ : state) {
+        estimator.estimate_lights(rgb, depth);
+        benchmark::DoNotOptimize(estimator.get_lights().data());
+    }
+}
+BENCHMARK_TEMPLATE(BM_LightEstimator, RandLightEstimator)->Arg(1)->Arg(8);
+BENCHMARK_TEMPLATE(BM_LightEstimator, ConstLightEstimator)->Arg(1)->Arg(8);
+
+// Macro benchmark: the estimation stage of the pipeline, as run for every frame
+void BM_EstimationStage(benchmark::State &state)
+{
+    cv::Mat rgb, raw_depth, depth;
+    make_synthetic_frame(0, rgb, raw_depth);
+    make_synthetic_depth(raw_depth, depth);
+
+    ThreadPool pool(2);
+    ConstLightEstimator light_estimator(1);
+    MorphologicalDepthCompleter depth_completer(OfflineDatasetType::ETH3D);
+    EstimationExecutor estimation(pool, light_estimator, depth_completer);
+    for (auto _ : state) {
+        estimation.run(rgb, depth);
+        benchmark::DoNotOptimize(estimation.get_depth_image().data);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EstimationStage)->Unit(benchmark::kMillisecond);
+
+// Arg is the number of lights, which are spread over a few meters in front of the camera,
+// and reach up to about a meter and a half. Tiles reach the depth of the scene.
+void BM_LightCulling(benchmark::State &state)
+{
+    LightGrid grid(WIDTH, HEIGHT, ETH3D_SETTINGS);
+    grid.set_depth(cv::Mat(HEIGHT, WIDTH, CV_32FC1, cv::Scalar(3.0f)));
+
+    cv::RNG rng(7);
+    std::vector<Light> lights(state.range(0));
+    for (int i = 0; i < lights.size(); i++) {
+        lights[i].position = glm::vec3(rng.uniform(-2.0f, 2.0f), rng.uniform(-1.5f, 1.5f), rng.uniform(0.5f, 4.0f));
+        lights[i].color = glm::vec3(rng.uniform(0.25f, 1.0f));
+        lights[i].intensity = rng.uniform(0.5f, 2.0f);
+    }
+
+    const Eigen::Matrix4f camera_pose = Eigen::Matrix4f::Identity();
+    for (auto _ : state) {
+        grid.cull(lights, camera_pose);
+        benchmark::DoNotOptimize(grid.get_max_tile_lights());
+    }
+
+    state.counters["avg_tile_lights"] = grid.get_average_tile_lights();
+    state.counters["max_tile_lights"] = grid.get_max_tile_lights();
+    state.counters["dropped_tile_lights"] = grid.get_dropped_tile_lights();
+}
+BENCHMARK(BM_LightCulling)->Arg(4)->Arg(100)->Arg(500)->Unit(benchmark::kMicrosecond);
+
+// Args are the number of tracked points, and whether RANSAC is adaptive (with
+// progressive sampling) or always runs the full 50 uniformly sampled iterations
+void BM_DetectPlane(benchmark::State &state)
+{
+    std::vector<TrackedPoint> map_points;
+    std::vector<cv::KeyPoint> key_points;
+    make_synthetic_map(state.range(0), map_points, key_points);
+    const Eigen::Matrix4f camera_pose = Eigen::Matrix4f::Identity();
+
+    RansacSettings settings;
+    settings.adaptive = (state.range(1) != 0);
+    settings.prioritize_observed = settings.adaptive;
+
+    // The plane detection logs its progress, which shouldn't be timed
+    std::streambuf* cout_buffer = std::cout.rdbuf(nullptr);
+    double iterations = 0.0, inliers = 0.0;
+    for (auto _ : state) {
+        RansacStats stats;
+        Plane* plane = detect_plane(map_points, key_points, camera_pose, settings, &stats);
+        benchmark::DoNotOptimize(plane);
+        delete plane;
+
+        iterations += stats.iterations;
+        inliers += stats.inliers;
+    }
+    std::cout.rdbuf(cout_buffer);
+
+    state.counters["iterations"] = benchmark::Counter(iterations, benchmark::Counter::kAvgIterations);
+    state.counters["inliers"] = benchmark::Counter(inliers, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_DetectPlane)->ArgsProduct({{100, 500, 2000}, {0, 1}})->Unit(benchmark::kMicrosecond);
+
+// Constructing a Plane from its parameters only recomputes its model matrix
+void BM_PlaneModelMatrix(benchmark::State &state)
+{
+    const Eigen::Vector3f origin(0.1f, 0.7f, 2.0f);
+    const Eigen::Vector3f normal = Eigen::Vector3f(0.0f, 0.98f, -0.2f).normalized();
+    for (auto _ : state) {
+        Plane plane(origin, normal, 0.3f);
+        benchmark::DoNotOptimize(plane.get_model_matrix());
+    }
+}
+BENCHMARK(BM_PlaneModelMatrix);
+
+void BM_ExpSO3(benchmark::State &state)
+{
+    float angle = 0.0f;
+    for (auto _ : state) {
+        Eigen::Matrix3f rotation = ExpSO3(0.1f, angle, 0.3f);
+        benchmark::DoNotOptimize(rotation);
+        angle += 1e-3f;
+    }
+}
+BENCHMARK(BM_ExpSO3);
+
+void BM_GlmFromEigen(benchmark::State &state)
+{
+    Eigen::Matrix4f pose = Eigen::Matrix4f::Identity();
+    pose.topLeftCorner<3, 3>() = ExpSO3(0.1f, 0.2f, 0.3f);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(pose);
+        glm::mat4 matrix = glm_from_eigen(pose);
+        benchmark::DoNotOptimize(matrix);
+    }
+}
+BENCHMARK(BM_GlmFromEigen);
+
+// Model loading uploads meshes and textures, so it needs a GL context
+GLFWwindow* g_window = nullptr;
+
+void BM_LoadModel(benchmark::State &state)
+{
+    if (!g_window) {
+        state.SkipWithError("No OpenGL context available");
+        return;
+    }
+
+    for (auto _ : state) {
+        Model model(CUBE_MODEL);
+        benchmark::DoNotOptimize(&model);
+    }
+}
+BENCHMARK(BM_LoadModel)->Unit(benchmark::kMillisecond);
+
+// Arg is the number of placed objects, which are all drawn with one call per mesh
+void BM_SceneDraw(benchmark::State &state)
+{
+    if (!g_window) {
+        state.SkipWithError("No OpenGL context available");
+        return;
+    }
+
+    Shader shader(SOURCE_DIR + "/shaders/geometry_vert.glsl", SOURCE_DIR + "/shaders/geometry_frag.glsl");
+    Scene scene(CUBE_MODEL);
+    scene.load();
+
+    std::vector<Plane*> planes;
+    for (int i = 0; i < state.range(0); i++) {
+        planes.push_back(new Plane(Eigen::Vector3f(0.01f * i, 0.0f, 2.0f), Eigen::Vector3f::UnitY(), 0.1f * i));
+        scene.add_object(planes.back());
+    }
+
+    // The view and projection are identity, and stay the same between frames
+    FrameUniforms uniforms = {};
+    uniforms.view = glm::mat4(1.0f);
+    uniforms.persp = glm::mat4(1.0f);
+    GLuint ubo;
+    glGenBuffers(1, &ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), &uniforms, GL_STATIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, ubo);
+    shader.bind_uniform_block("FrameData", FRAME_UNIFORMS_BINDING);
+
+    shader.use();
+    for (auto _ : state) {
+        scene.update(0.016f);
+        scene.draw(shader);
+        glFinish();
+    }
+
+    for (int i = 0; i < planes.size(); i++) {
+        delete planes[i];
+    }
+    glDeleteBuffers(1, &ubo);
+}
+BENCHMARK(BM_SceneDraw)->Arg(1)->Arg(100)->Arg(1000)->Unit(benchmark::kMicrosecond);
+
+bool create_gl_context()
+{
+    if (!glfwInit()) {
+        return false;
+    }
+
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    g_window = glfwCreateWindow(64, 64, "mixed_reality_bench", nullptr, nullptr);
+    if (!g_window) {
+        return false;
+    }
+
+    glfwMakeContextCurrent(g_window);
+    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
+        glfwDestroyWindow(g_window);
+        g_window = nullptr;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+
+    if (!create_gl_context()) {
+        std::cerr << "[BENCH]: Can't create an OpenGL context, skipping model loading" << std::endl;
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    if (g_window) {
+        glfwDestroyWindow(g_window);
+    }
+    glfwTerminate();
+    return 0;
+}
@@ -0,0 +1,33 @@
+#include <iostream>
+#include <string>
+
+#include "util/camera_util.h"
+#include "util/packed_dataset.h"
+
+int main(int argc, char* argv[])
+{
+    if (argc < 4) {
+        std::cerr << "Usage: ./pack_dataset [ETH3D|ScanNet] [dataset_dir] [output_file]" << std::endl;
+        return -1;
+    }
+
+    std::string dataset = argv[1];
+    OfflineDatasetType type;
+    if (dataset == "ETH3D") {
+        type = OfflineDatasetType::ETH3D;
+    } else if (dataset == "ScanNet") {
+        type = OfflineDatasetType::SCANNET;
+    } else {
+        std::cerr << "Invalid dataset type provided" << std::endl;
+        return -1;
+    }
+
+    try {
+        write_packed_dataset(argv[2], type, argv[3]);
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -42,6 +42,22 @@ std::vector<std::tuple<std::string, std::string, double>> load_offline_dataset(c
     return ret;
 }
 
+void set_dataset_resolution(OfflineDatasetType type, int &width, int &height)
+{
+    switch (type) {
+        case OfflineDatasetType::ETH3D: {
+            width = 736;
+            height = 456;
+            break;
+        }
+        case OfflineDatasetType::SCANNET: {
+            width = 1296;
+            height = 968;
+            break;
+        }
+    }
+}
+
 std::tuple<std::string, std::string, double> process_eth3d(const std::string &line)
 {
     std::stringstream ss;
@@ -0,0 +1,119 @@
+#include "util/depth_util.h"
+
+namespace
+{
+
+// Interpolates between two rows
+void blend_rows(const float* top, const float* bottom, float weight, float* dst, int n)
+{
+    int i = 0;
+#if CV_SIMD
+    const cv::v_float32 v_weight = cv::vx_setall_f32(weight);
+    for (; i <= n - cv::v_float32::nlanes; i += cv::v_float32::nlanes) {
+        cv::v_float32 a = cv::vx_load(top + i);
+        cv::v_float32 b = cv::vx_load(bottom + i);
+        cv::v_store(dst + i, cv::v_fma(b - a, v_weight, a));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = top[i] + (bottom[i] - top[i]) * weight;
+    }
+}
+
+// Source pixels and weight of an output pixel, with the same mapping as cv::resize
+void source_pixels(int dst_index, float ratio, int src_size, int &first, int &second, float &weight)
+{
+    float position = (dst_index + 0.5f) * ratio - 0.5f;
+    first = static_cast<int>(std::floor(position));
+    weight = position - first;
+    if (first < 0) {
+        first = 0;
+        weight = 0.0f;
+    }
+    if (first >= src_size - 1) {
+        first = src_size - 1;
+        weight = 0.0f;
+    }
+    second = std::min(first + 1, src_size - 1);
+}
+
+} // namespace
+
+void convert_depth_row(const ushort* src, float* dst, int n, float scale, float min_valid, float fill)
+{
+    int i = 0;
+#if CV_SIMD
+    const cv::v_float32 v_scale = cv::vx_setall_f32(scale);
+    const cv::v_float32 v_min_valid = cv::vx_setall_f32(min_valid);
+    const cv::v_float32 v_fill = cv::vx_setall_f32(fill);
+    for (; i <= n - cv::v_float32::nlanes; i += cv::v_float32::nlanes) {
+        cv::v_float32 depth = cv::v_cvt_f32(cv::v_reinterpret_as_s32(cv::vx_load_expand(src + i))) * v_scale;
+        cv::v_store(dst + i, cv::v_select(depth > v_min_valid, depth, v_fill));
+    }
+#endif
+    for (; i < n; i++) {
+        float depth = src[i] * scale;
+        dst[i] = (depth > min_valid) ? depth : fill;
+    }
+}
+
+void convert_depth(const cv::Mat &raw_depth, cv::Mat &depth, cv::Size size, float scale, float min_valid, float fill)
+{
+    CV_Assert(raw_depth.type() == CV_16UC1 && !raw_depth.empty());
+    depth.create(size, CV_32FC1);
+
+    // Without resampling, each row is converted directly into the output
+    if (size == raw_depth.size()) {
+        cv::parallel_for_(cv::Range(0, size.height), [&](const cv::Range &range) {
+            for (int y = range.start; y < range.end; y++) {
+                convert_depth_row(raw_depth.ptr<ushort>(y), depth.ptr<float>(y), size.width, scale, min_valid, fill);
+            }
+        });
+        return;
+    }
+
+    const int src_cols = raw_depth.cols, src_rows = raw_depth.rows;
+    const float ratio_x = static_cast<float>(src_cols) / size.width;
+    const float ratio_y = static_cast<float>(src_rows) / size.height;
+
+    std::vector<int> first_cols(size.width), second_cols(size.width);
+    std::vector<float> col_weights(size.width);
+    for (int x = 0; x < size.width; x++) {
+        source_pixels(x, ratio_x, src_cols, first_cols[x], second_cols[x], col_weights[x]);
+    }
+
+    // Each output row converts the two source rows it needs, blends them
+    // vertically at the source width, and then interpolates horizontally.
+    cv::parallel_for_(cv::Range(0, size.height), [&](const cv::Range &range) {
+        std::vector<float> top(src_cols), bottom(src_cols), blended(src_cols);
+        int top_row = -1, bottom_row = -1;
+
+        for (int y = range.start; y < range.end; y++) {
+            int first_row, second_row;
+            float row_weight;
+            source_pixels(y, ratio_y, src_rows, first_row, second_row, row_weight);
+
+            // Consecutive output rows often share their source rows when upsampling
+            if (first_row != top_row) {
+                if (first_row == bottom_row) {
+                    top.swap(bottom);
+                    std::swap(top_row, bottom_row);
+                } else {
+                    convert_depth_row(raw_depth.ptr<ushort>(first_row), top.data(), src_cols, scale, min_valid, fill);
+                    top_row = first_row;
+                }
+            }
+            if (second_row != bottom_row) {
+                convert_depth_row(raw_depth.ptr<ushort>(second_row), bottom.data(), src_cols, scale, min_valid, fill);
+                bottom_row = second_row;
+            }
+            blend_rows(top.data(), bottom.data(), row_weight, blended.data(), src_cols);
+
+            float* dst = depth.ptr<float>(y);
+            for (int x = 0; x < size.width; x++) {
+                float left = blended[first_cols[x]];
+                dst[x] = left + (blended[second_cols[x]] - left) * col_weights[x];
+            }
+        }
+    });
+}
@@ -2,7 +2,154 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-Plane::Plane(const cv::Mat &origin, const cv::Mat &normal, float orientation) :
+namespace
+{
+
+// Hypotheses are only spread across threads when there are enough points to make it worth it
+const int RANSAC_POINTS_PER_STRIPE = 16384;
+
+// Adaptive runs reconsider how many hypotheses they need after every batch
+const int RANSAC_BATCH_SIZE = 8;
+
+// The score is the 20th percentile distance, which is well inside the noise of a good plane.
+// For estimating the inlier ratio, points within a few times that distance count as inliers.
+const float ADAPTIVE_INLIER_SCALE = 4.0f;
+
+// Progressive sampling starts out with at least this many of the best points
+const int PROSAC_MIN_POOL = 20;
+
+// Each per-instance mat4 takes four consecutive attribute locations, one per column
+const int INSTANCE_PLANE_LOCATION = 3;
+const int INSTANCE_LOCAL_LOCATION = 7;
+
+// Material samplers of the geometry shader
+constexpr UniformName UNIFORM_TEXTURE_DIFFUSE("material.texture_diffuse");
+constexpr UniformName UNIFORM_TEXTURE_SPECULAR("material.texture_specular");
+
+// Candidate points for plane detection, with each coordinate in its own array
+struct PlanePoints
+{
+    std::vector<float> x, y, z;
+};
+
+// Plane ax + by + cz + d = 0 through three points, scaled so that |(a, b, c, d)| = 1. This is the
+// same plane (and scale) as the null space of the 3x4 system used before, but without an SVD.
+bool plane_from_points(const PlanePoints &points, const cv::Vec3i &sample, cv::Vec4f &plane)
+{
+    const int i0 = sample[0], i1 = sample[1], i2 = sample[2];
+    const float ux = points.x[i1] - points.x[i0], uy = points.y[i1] - points.y[i0], uz = points.z[i1] - points.z[i0];
+    const float vx = points.x[i2] - points.x[i0], vy = points.y[i2] - points.y[i0], vz = points.z[i2] - points.z[i0];
+
+    const float a = uy * vz - uz * vy;
+    const float b = uz * vx - ux * vz;
+    const float c = ux * vy - uy * vx;
+    const float d = -(a * points.x[i0] + b * points.y[i0] + c * points.z[i0]);
+
+    // Collinear points don't define a plane
+    const float norm = std::sqrt(a * a + b * b + c * c + d * d);
+    if (a * a + b * b + c * c < 1e-12f || norm <= 0.0f)
+        return false;
+
+    plane = cv::Vec4f(a / norm, b / norm, c / norm, d / norm);
+    return true;
+}
+
+// Distances of every point to the plane, in the same (scaled) units as the plane
+void plane_distances(const PlanePoints &points, const cv::Vec4f &plane, float* distances)
+{
+    const int n = points.x.size();
+    const float* x = points.x.data();
+    const float* y = points.y.data();
+    const float* z = points.z.data();
+
+    int i = 0;
+#if CV_SIMD
+    const cv::v_float32 v_a = cv::vx_setall_f32(plane[0]);
+    const cv::v_float32 v_b = cv::vx_setall_f32(plane[1]);
+    const cv::v_float32 v_c = cv::vx_setall_f32(plane[2]);
+    const cv::v_float32 v_d = cv::vx_setall_f32(plane[3]);
+    for (; i <= n - cv::v_float32::nlanes; i += cv::v_float32::nlanes) {
+        cv::v_float32 distance = cv::v_fma(cv::vx_load(x + i), v_a, v_d);
+        distance = cv::v_fma(cv::vx_load(y + i), v_b, distance);
+        distance = cv::v_fma(cv::vx_load(z + i), v_c, distance);
+        cv::v_store(distances + i, cv::v_abs(distance));
+    }
+#endif
+    for (; i < n; i++) {
+        distances[i] = std::fabs(x[i] * plane[0] + y[i] * plane[1] + z[i] * plane[2] + plane[3]);
+    }
+}
+
+// Number of minimal samples needed to draw one without outliers with the given confidence
+int ransac_iterations(float inlier_ratio, float confidence)
+{
+    const double all_inliers = std::pow(static_cast<double>(inlier_ratio), 3);
+    if (all_inliers >= 1.0)
+        return 1;
+    if (all_inliers <= 0.0)
+        return std::numeric_limits<int>::max();
+
+    const double iterations = std::ceil(std::log(1.0 - confidence) / std::log(1.0 - all_inliers));
+    return static_cast<int>(std::min(iterations, static_cast<double>(std::numeric_limits<int>::max())));
+}
+
+// Three distinct indices out of the first n, drawn uniformly without replacement. The picked
+// indices are swapped out of the available range, and swapped back afterwards.
+cv::Vec3i draw_sample(std::vector<int> &available_indices, int n)
+{
+    cv::Vec3i sample;
+    int picked[3];
+    for (int i = 0; i < 3; i++)
+    {
+        picked[i] = DUtils::Random::RandomInt(0, n - 1 - i);
+        sample[i] = available_indices[picked[i]];
+        std::swap(available_indices[picked[i]], available_indices[n - 1 - i]);
+    }
+    for (int i = 2; i >= 0; i--)
+    {
+        std::swap(available_indices[picked[i]], available_indices[n - 1 - i]);
+    }
+    return sample;
+}
+
+std::vector<cv::Vec3i> draw_uniform_samples(int N, int iterations)
+{
+    std::vector<int> available_indices(N);
+    for (int i = 0; i < N; i++)
+    {
+        available_indices[i] = i;
+    }
+
+    std::vector<cv::Vec3i> samples(iterations);
+    for (int n = 0; n < iterations; n++)
+    {
+        samples[n] = draw_sample(available_indices, N);
+    }
+    return samples;
+}
+
+// PROSAC-style sampling over points sorted from best to worst. Samples start out among the
+// best points, and the pool grows linearly so that it covers every point by the last iteration.
+std::vector<cv::Vec3i> draw_progressive_samples(int N, int iterations)
+{
+    std::vector<int> available_indices(N);
+    for (int i = 0; i < N; i++)
+    {
+        available_indices[i] = i;
+    }
+
+    std::vector<cv::Vec3i> samples(iterations);
+    for (int n = 0; n < iterations; n++)
+    {
+        const int pool = std::min(N, std::max(PROSAC_MIN_POOL, (int) std::ceil(static_cast<double>(N) * (n + 1) / iterations)));
+        samples[n] = draw_sample(available_indices, pool);
+    }
+    return samples;
+}
+
+} // namespace
+
+Plane::Plane(const Eigen::Vector3f &origin, const Eigen::Vector3f &normal, float orientation) :
     m_origin{origin},
     m_normal{normal},
     m_orientation{orientation}
@@ -10,70 +157,65 @@ Plane::Plane(const cv::Mat &origin, const cv::Mat &normal, float orientation) :
     recompute_model_matrix();
 }
 
-Plane::Plane(const std::vector<ORB_SLAM3::MapPoint*> &plane_points, const cv::Mat &camera_pose)
+Plane::Plane(const std::vector<TrackedPoint> &plane_points, const Eigen::Matrix4f &camera_pose)
 {
     m_orientation = -3.14f / 2 + ((float) rand() / RAND_MAX) * 3.14f;
 
-    const int N = plane_points.size();
-
-    // Recompute plane with all points
-    cv::Mat A = cv::Mat(N, 4, CV_32F);
-    A.col(3) = cv::Mat::ones(N, 1, CV_32F);
-
-    m_origin = cv::Mat::zeros(3,1,CV_32F);
-
+    // Recompute plane with all points, as the direction of least variance around their centroid
+    Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d sum_squares = Eigen::Matrix3d::Zero();
     int num_points = 0;
-    for (int i = 0; i < N; i++)
+    for (int i = 0; i < plane_points.size(); i++)
     {
-        ORB_SLAM3::MapPoint* map_point = plane_points[i];
-        if (!map_point->isBad())
+        const TrackedPoint &map_point = plane_points[i];
+        if (!map_point.bad)
         {
-            cv::Mat world_pos = ORB_SLAM3::Converter::toCvMat(map_point->GetWorldPos());
-            m_origin += world_pos;
-            A.row(num_points).colRange(0,3) = world_pos.t();
+            const Eigen::Vector3d world_pos(map_point.position.x, map_point.position.y, map_point.position.z);
+            sum += world_pos;
+            sum_squares += world_pos * world_pos.transpose();
             num_points++;
         }
     }
-    A.resize(num_points);
-
-    cv::Mat u, w, vt;
-    cv::SVDecomp(A, w, u, vt, cv::SVD::MODIFY_A | cv::SVD::FULL_UV);
 
-    float a = vt.at<float>(3, 0);
-    float b = vt.at<float>(3, 1);
-    float c = vt.at<float>(3, 2);
-    std::cout << "[PLANE]: Plane coefficients: " << a << " " << b << " " << c << std::endl;
+    const Eigen::Vector3d mean = sum / num_points;
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+    solver.computeDirect(sum_squares / num_points - mean * mean.transpose());
 
-    m_origin = m_origin * (1.0f / num_points);
-    const float f = 1.0f / sqrt(a * a + b * b + c * c);
+    m_origin = mean.cast<float>();
+    m_normal = solver.eigenvectors().col(0).cast<float>().normalized();
+    std::cout << "[PLANE]: Plane coefficients: " << m_normal(0) << " " << m_normal(1) << " " << m_normal(2) << std::endl;
 
-    cv::Mat Oc = -camera_pose.colRange(0,3).rowRange(0,3).t() * camera_pose.rowRange(0,3).col(3);
-    cv::Mat XC = Oc - m_origin;
-
-    if ((XC.at<float>(0) * a + XC.at<float>(1) * b + XC.at<float>(2) * c) > 0)
+    // The normal points away from the camera
+    if (m_normal.dot(camera_center(camera_pose) - m_origin) > 0)
     {
-        a = -a;
-        b = -b;
-        c = -c;
+        m_normal = -m_normal;
     }
 
-    m_normal = (cv::Mat_<float>(3,1) << a * f, b * f, c * f);
-
     recompute_model_matrix();
 }
 
 void Plane::recompute_model_matrix()
 {
-    cv::Mat up = (cv::Mat_<float>(3,1) << 0.0f, 1.0f, 0.0f);
-    cv::Mat v = up.cross(m_normal);
-    const float sa = cv::norm(v);
+    const Eigen::Vector3f up = Eigen::Vector3f::UnitY();
+    const Eigen::Vector3f v = up.cross(m_normal);
+    const float sa = v.norm();
     const float ca = up.dot(m_normal);
     const float ang = atan2(sa, ca);
 
-    cv::Mat transform = cv::Mat::eye(4, 4, CV_32F);
-    transform.rowRange(0, 3).colRange(0, 3) = ExpSO3(v * ang / sa) * ExpSO3(up * m_orientation);
-    m_origin.copyTo(transform.col(3).rowRange(0,3));
-    m_model_matrix = glm_from_cv(transform);
+    // A normal along the up axis has no rotation axis, and is tilted around x if it's upside down
+    const Eigen::Vector3f tilt = (sa > EPSILON) ? Eigen::Vector3f(v * (ang / sa)) : Eigen::Vector3f(ang, 0.0f, 0.0f);
+
+    Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+    transform.topLeftCorner<3, 3>() = ExpSO3(tilt) * ExpSO3(up * m_orientation);
+    transform.topRightCorner<3, 1>() = m_origin;
+    m_model_matrix = glm_from_eigen(transform);
+}
+
+void Plane::set_plane(const Eigen::Vector3f &origin, const Eigen::Vector3f &normal)
+{
+    m_origin = origin;
+    m_normal = normal;
+    recompute_model_matrix();
 }
 
 const glm::mat4& Plane::get_model_matrix() const
@@ -81,132 +223,150 @@ const glm::mat4& Plane::get_model_matrix() const
     return m_model_matrix;
 }
 
-std::tuple<cv::Mat, cv::Mat, float> Plane::get_plane_information() const
+std::tuple<Eigen::Vector3f, Eigen::Vector3f, float> Plane::get_plane_information() const
 {
     return std::make_tuple(m_origin, m_normal, m_orientation);
 }
 
-Plane* detect_plane(const std::vector<ORB_SLAM3::MapPoint*> &curr_map_points, 
+Plane* detect_plane(const std::vector<TrackedPoint> &curr_map_points, 
                     const std::vector<cv::KeyPoint> &curr_key_points, 
-                    const cv::Mat &curr_camera_pose)
+                    const Eigen::Matrix4f &curr_camera_pose,
+                    const RansacSettings &settings,
+                    RansacStats* stats)
 {
     // Retrieve 3D points
-    std::vector<cv::Mat> points;
-    std::vector<ORB_SLAM3::MapPoint*> map_points;
-	std::vector<cv::KeyPoint> key_points;
-
+    std::vector<int> candidates;
     for (int i = 0; i < curr_map_points.size(); i++)
     {
-        ORB_SLAM3::MapPoint* map_point = curr_map_points[i];
-        if (map_point)
+        const TrackedPoint &map_point = curr_map_points[i];
+        if (map_point.id >= 0 && map_point.observations > 5)
         {
-            if (map_point->Observations() > 5)
-            {
-                points.push_back(ORB_SLAM3::Converter::toCvMat(map_point->GetWorldPos()));
-                map_points.push_back(map_point);
-				key_points.push_back(curr_key_points[i]);
-            }
+            candidates.push_back(i);
         }
     }
 
-    const int N = points.size();
+    const int N = candidates.size();
 
     if (N < 50)
+    {
+        if (stats)
+        {
+            *stats = RansacStats{0, 0, 0.0f};
+        }
         return nullptr;
+    }
 
-    // Indices for minimum set selection
-    std::vector<size_t> all_indices;
-    std::vector<size_t> available_indices;
+    // Points seen from more key frames (and then with stronger key point responses)
+    // have better triangulated positions, so they're sampled first.
+    if (settings.prioritize_observed)
+    {
+        std::stable_sort(candidates.begin(), candidates.end(), [&](int i, int j) {
+            if (curr_map_points[i].observations != curr_map_points[j].observations)
+                return curr_map_points[i].observations > curr_map_points[j].observations;
+            return curr_key_points[i].response > curr_key_points[j].response;
+        });
+    }
 
+    PlanePoints points;
+    std::vector<TrackedPoint> map_points(N);
+    points.x.resize(N);
+    points.y.resize(N);
+    points.z.resize(N);
     for (int i = 0; i < N; i++)
     {
-        all_indices.push_back(i);
+        map_points[i] = curr_map_points[candidates[i]];
+        points.x[i] = map_points[i].position.x;
+        points.y[i] = map_points[i].position.y;
+        points.z[i] = map_points[i].position.z;
     }
 
-    float best_dist = 1e10;
-    std::vector<float> best_dists;
-	int best_it = 0;
-
-	std::vector<int> plane_points;
-
-    // RANSAC
-    for (int n = 0; n < 50; n++)
+    // Minimal sets are drawn up front, so the random sequence doesn't
+    // depend on how the iterations are scheduled across threads.
+    const int max_iterations = std::max(1, settings.max_iterations);
+    std::vector<cv::Vec3i> samples = settings.prioritize_observed ? 
+                                     draw_progressive_samples(N, max_iterations) : 
+                                     draw_uniform_samples(N, max_iterations);
+
+    // RANSAC, scoring each hypothesis by the distance to its 20th percentile point.
+    // Adaptive runs evaluate hypotheses in batches, and stop once enough were tried.
+    const int nth = std::max((int) (0.2 * N), 20);
+    std::vector<float> scores(max_iterations, std::numeric_limits<float>::max());
+    std::vector<int> inliers(max_iterations, 0);
+    int required_iterations = max_iterations;
+    int iterations = 0;
+    int best_it = -1;
+    float best_dist = std::numeric_limits<float>::max();
+    while (iterations < required_iterations)
     {
-        available_indices = all_indices;
-
-        cv::Mat A(3, 4, CV_32F);
-        A.col(3) = cv::Mat::ones(3, 1, CV_32F);
-
-		std::vector<int> plane_point_indices;
-    
-        // Get min set of points
-        for (size_t i = 0; i < 3; i++)
-        {
-            int rand_idx = DUtils::Random::RandomInt(0, available_indices.size() - 1);
-            int idx = available_indices[rand_idx];
-			plane_point_indices.push_back(idx);
-
-            A.row(i).colRange(0, 3) = points[idx].t();
-
-            available_indices[rand_idx] = available_indices.back();
-            available_indices.pop_back();
-        }
-
-        cv::Mat u, w, vt;
-        cv::SVDecomp(A, w, u, vt, cv::SVD::MODIFY_A | cv::SVD::FULL_UV);
-
-        const float a = vt.at<float>(3, 0);
-        const float b = vt.at<float>(3, 1);
-        const float c = vt.at<float>(3, 2);
-        const float d = vt.at<float>(3, 3);
-
-        std::vector<float> distances(N, 0);
+        const int batch_end = settings.adaptive ? std::min(required_iterations, iterations + RANSAC_BATCH_SIZE) : required_iterations;
+        cv::parallel_for_(cv::Range(iterations, batch_end), [&](const cv::Range &range) {
+            std::vector<float> distances(N);
+            for (int n = range.start; n < range.end; n++)
+            {
+                cv::Vec4f plane;
+                if (!plane_from_points(points, samples[n], plane))
+                    continue;
+
+                plane_distances(points, plane, distances.data());
+                std::nth_element(distances.begin(), distances.begin() + nth, distances.end());
+                scores[n] = distances[nth];
+
+                if (settings.adaptive)
+                {
+                    const float inlier_threshold = ADAPTIVE_INLIER_SCALE * scores[n];
+                    inliers[n] = std::count_if(distances.begin(), distances.end(), [&](float distance) { return distance < inlier_threshold; });
+                }
+            }
+        }, static_cast<double>(batch_end - iterations) * N / RANSAC_POINTS_PER_STRIPE);
 
-        const float f = 1.0f / sqrt(a * a + b * b + c * c + d * d);
-        for (int i = 0; i < N; i++)
+        // The first of the best hypotheses wins, just like in a sequential loop
+        for (int n = iterations; n < batch_end; n++)
         {
-            distances[i] = fabs(points[i].at<float>(0) * a + points[i].at<float>(1) * b + points[i].at<float>(2) * c + d) * f;
+            if (scores[n] < best_dist)
+            {
+                best_dist = scores[n];
+                best_it = n;
+                if (settings.adaptive)
+                {
+                    required_iterations = std::min(max_iterations, ransac_iterations(static_cast<float>(inliers[n]) / N, settings.confidence));
+                }
+            }
         }
+        iterations = batch_end;
+    }
 
-        std::vector<float> sorted = distances;
-        std::sort(sorted.begin(), sorted.end());
-
-        int nth = max((int) (0.2 * N), 20);
-        const float median_dist = sorted[nth];
+    if (stats)
+    {
+        stats->iterations = iterations;
+        stats->inliers = 0;
+        stats->best_distance = best_dist;
+    }
 
-        if(median_dist < best_dist)
-        {
-			plane_points = plane_point_indices;
-            best_dist = median_dist;
-            best_dists = distances;
-			best_it = n;
-        }
-	}
+    if (best_it < 0)
+        return nullptr;
 
-	std::cout << "[PLANE]: Best dist after RANSAC: " << best_dist << "\n";
+    std::cout << "[PLANE]: Best dist after " << iterations << " RANSAC iterations: " << best_dist << "\n";
 
     // Compute threshold inlier/outlier
+    cv::Vec4f best_plane;
+    plane_from_points(points, samples[best_it], best_plane);
+    std::vector<float> best_dists(N);
+    plane_distances(points, best_plane, best_dists.data());
+
     const float threshold = 1.4 * best_dist;
-    std::vector<bool> inlier_flags(N, false);
-    int inlier_count = 0;
+    std::vector<TrackedPoint> inlier_map_points;
+    inlier_map_points.reserve(N);
     for (int i = 0; i < N; i++)
     {
         if(best_dists[i] < threshold)
         {
-            inlier_count++;
-            inlier_flags[i] = true;
+            inlier_map_points.push_back(map_points[i]);
         }
     }
 
-    std::vector<ORB_SLAM3::MapPoint*> inlier_map_points(inlier_count, nullptr);
-    int inlier_idx = 0;
-    for (int i = 0; i < N; i++)
+    if (stats)
     {
-        if(inlier_flags[i])
-        {
-            inlier_map_points[inlier_idx] = map_points[i];
-            inlier_idx++;
-        }
+        stats->inliers = inlier_map_points.size();
     }
 
     return new Plane(inlier_map_points, curr_camera_pose);
@@ -248,31 +408,50 @@ void Mesh::setup_mesh()
     glBindVertexArray(0);
 }
 
-void Mesh::draw(Shader &shader)
+void Mesh::set_instance_buffer(unsigned int instance_vbo)
+{
+    glBindVertexArray(m_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+
+    for (int c = 0; c < 4; c++) {
+        glEnableVertexAttribArray(INSTANCE_PLANE_LOCATION + c);
+        glVertexAttribPointer(INSTANCE_PLANE_LOCATION + c, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*) (offsetof(InstanceData, plane) + c * sizeof(glm::vec4)));
+        glVertexAttribDivisor(INSTANCE_PLANE_LOCATION + c, 1);
+
+        glEnableVertexAttribArray(INSTANCE_LOCAL_LOCATION + c);
+        glVertexAttribPointer(INSTANCE_LOCAL_LOCATION + c, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*) (offsetof(InstanceData, local) + c * sizeof(glm::vec4)));
+        glVertexAttribDivisor(INSTANCE_LOCAL_LOCATION + c, 1);
+    }
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void Mesh::draw(Shader &shader, int instances)
 {
     unsigned int diffuse = 1, specular = 1, normal = 1;
 
     for (int i = 0; i < m_textures.size(); i++) {
         glActiveTexture(GL_TEXTURE0 + i);
-        Texture texture = m_textures[i];
+        const Texture &texture = m_textures[i];
 
-        std::string name = "material.";
         switch (texture.type) {
             case TextureType::TEXTURE_DIFFUSE: {
-                name += "texture_diffuse";
+                shader.set_int(UNIFORM_TEXTURE_DIFFUSE, i);
+                break;
             }
             case TextureType::TEXTURE_SPECULAR: {
-                name += "texture_specular";
+                shader.set_int(UNIFORM_TEXTURE_SPECULAR, i);
+                break;
             }
         }
 
-        shader.set_int(name, i);
         glBindTexture(GL_TEXTURE_2D, texture.id);
     }
 
-    // Draw the geometry after all the textures have been set
+    // Draw every instance of the geometry after all the textures have been set
     glBindVertexArray(m_vao);
-    glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(m_indices.size()), GL_UNSIGNED_INT, 0);
+    glDrawElementsInstanced(GL_TRIANGLES, static_cast<unsigned int>(m_indices.size()), GL_UNSIGNED_INT, 0, instances);
     
     // Reset things to the default
     glBindVertexArray(0);
@@ -296,10 +475,17 @@ Model::Model(const std::string &filepath)
     process_node(scene->mRootNode, scene);
 } 
 
-void Model::draw(Shader &shader)
+void Model::set_instance_buffer(unsigned int instance_vbo)
+{
+    for (int i = 0; i < m_meshes.size(); i++) {
+        m_meshes[i].set_instance_buffer(instance_vbo);
+    }
+}
+
+void Model::draw(Shader &shader, int instances)
 {
     for (int i = 0; i < m_meshes.size(); i++) {
-        m_meshes[i].draw(shader);
+        m_meshes[i].draw(shader, instances);
     }
 }
 
@@ -492,7 +678,9 @@ glm::mat4 Transformation::transform_matrix()
 }
 
 Scene::Scene(const std::string &filepath) :
-    m_filepath{filepath}
+    m_filepath{filepath},
+    m_instance_vbo{0},
+    m_instance_capacity{0}
 {
     // Start with an empty scene
 }
@@ -500,15 +688,39 @@ Scene::Scene(const std::string &filepath) :
 void Scene::load()
 {
     m_model = Model(m_filepath);
+
+    // Every mesh reads the object matrices from the same instance buffer
+    glGenBuffers(1, &m_instance_vbo);
+    m_model.set_instance_buffer(m_instance_vbo);
 }
 
 void Scene::draw(Shader &shader)
 {
+    if (m_planes.empty()) {
+        return;
+    }
+
+    upload_instances();
+    m_model.draw(shader, m_planes.size());
+}
+
+void Scene::upload_instances()
+{
+    m_instances.resize(m_planes.size());
     for (int i = 0; i < m_planes.size(); i++) {
-        shader.set_mat4("plane", m_planes[i]->get_model_matrix());
-        shader.set_mat4("local", m_transforms[i].transform_matrix());
-        m_model.draw(shader);
+        m_instances[i].plane = m_planes[i]->get_model_matrix();
+        m_instances[i].local = m_transforms[i].transform_matrix();
+    }
+
+    // The buffer is orphaned every frame, so the driver never has to wait for the
+    // previous frame's draws to finish, and it's grown geometrically as objects are added.
+    if (m_instance_capacity < m_instances.size()) {
+        m_instance_capacity = std::max(2 * m_instance_capacity, m_instances.size());
     }
+    glBindBuffer(GL_ARRAY_BUFFER, m_instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, m_instance_capacity * sizeof(InstanceData), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, m_instances.size() * sizeof(InstanceData), m_instances.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 void Scene::add_object(Plane *plane)
@@ -1,26 +1,5 @@
 #include "util/matrix_util.h"
 
-cv::Mat ExpSO3(float x, float y, float z)
-{
-    cv::Mat I = cv::Mat::eye(3, 3, CV_32F);
-    const float d2 = x * x + y * y + z * z;
-    const float d = sqrt(d2);
-    cv::Mat W = (cv::Mat_<float>(3, 3) << 
-                  0, -z,  y,
-                  z,  0, -x,
-                 -y,  x,  0);
-    if (d < EPSILON) {
-        return (I + W + 0.5f * W * W);
-    }
-    
-    return (I + W * sin(d) / d + W * W * (1.0f - cos(d)) / d2);
-}
-
-cv::Mat ExpSO3(const cv::Mat &v)
-{
-    return ExpSO3(v.at<float>(0), v.at<float>(1), v.at<float>(2));
-}
-
 glm::mat4 camera_projection(size_t width, size_t height, const std::string &camera_settings)
 {
     cv::FileStorage settings(camera_settings, cv::FileStorage::READ);
@@ -50,30 +29,3 @@ glm::mat4 camera_projection(size_t width, size_t height, const std::string &came
 
     return persp;
 }
-
-glm::mat4 glm_from_cv(const cv::Mat &cv_matrix)
-{
-    glm::mat4 glm_matrix = glm::mat4(1.0f);
-
-    glm_matrix[0][0] = cv_matrix.at<float>(0, 0);
-    glm_matrix[0][1] = cv_matrix.at<float>(1, 0);
-    glm_matrix[0][2] = cv_matrix.at<float>(2, 0);
-    glm_matrix[0][3] = 0.0f;
-
-    glm_matrix[1][0] = cv_matrix.at<float>(0, 1);
-    glm_matrix[1][1] = cv_matrix.at<float>(1, 1);
-    glm_matrix[1][2] = cv_matrix.at<float>(2, 1);
-    glm_matrix[1][3] = 0.0f;
-
-    glm_matrix[2][0] = cv_matrix.at<float>(0, 2);
-    glm_matrix[2][1] = cv_matrix.at<float>(1, 2);
-    glm_matrix[2][2] = cv_matrix.at<float>(2, 2);
-    glm_matrix[2][3] = 0.0f;
-
-    glm_matrix[3][0] = cv_matrix.at<float>(0, 3);
-    glm_matrix[3][1] = cv_matrix.at<float>(1, 3);
-    glm_matrix[3][2] = cv_matrix.at<float>(2, 3);
-    glm_matrix[3][3] = 1.0f;
-
-    return glm_matrix;
-}
\ No newline at end of file
@@ -0,0 +1,268 @@
+#include "util/packed_dataset.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+uint64_t align_offset(uint64_t offset)
+{
+    return (offset + PACKED_ALIGNMENT - 1) & ~(PACKED_ALIGNMENT - 1);
+}
+
+uint64_t plane_size(int rows, int cols, int type)
+{
+    return static_cast<uint64_t>(rows) * cols * CV_ELEM_SIZE(type);
+}
+
+// Pads the file up to the next aligned offset and writes the image there
+PackedPlane write_plane(std::ofstream &file, const cv::Mat &image, uint32_t name)
+{
+    uint64_t offset = static_cast<uint64_t>(file.tellp());
+    uint64_t aligned = align_offset(offset);
+    const char padding[PACKED_ALIGNMENT] = {0};
+    file.write(padding, aligned - offset);
+
+    PackedPlane plane;
+    plane.offset = aligned;
+    plane.rows = image.rows;
+    plane.cols = image.cols;
+    plane.type = image.type();
+    plane.name = name;
+
+    // Images are stored without any row padding
+    cv::Mat continuous = image.isContinuous() ? image : image.clone();
+    file.write(reinterpret_cast<const char*>(continuous.data), plane_size(image.rows, image.cols, image.type()));
+
+    return plane;
+}
+
+uint32_t add_string(std::vector<char> &strings, const std::string &str)
+{
+    uint32_t offset = strings.size();
+    strings.insert(strings.end(), str.begin(), str.end());
+    strings.push_back('\0');
+    return offset;
+}
+
+} // namespace
+
+void write_packed_dataset(const std::string &dataset_dir, OfflineDatasetType type, const std::string &output_path)
+{
+    std::vector<std::tuple<std::string, std::string, double>> dataset = load_offline_dataset(dataset_dir, type);
+    if (dataset.empty()) {
+        throw std::runtime_error("[PACKED DATASET]: No frames to pack in " + dataset_dir);
+    }
+
+    std::ofstream file(output_path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("[PACKED DATASET]: Can't open " + output_path + " for writing");
+    }
+
+    // The header is rewritten once the index location is known
+    PackedHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, PACKED_MAGIC, sizeof(header.magic));
+    header.version = PACKED_VERSION;
+    header.dataset_type = static_cast<uint32_t>(type);
+    header.frame_count = dataset.size();
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<char> strings;
+    header.source_dir = add_string(strings, dataset_dir);
+
+    std::vector<PackedFrame> frames;
+    for (int i = 0; i < dataset.size(); i++) {
+        const std::tuple<std::string, std::string, double> &entry = dataset[i];
+
+        cv::Mat rgb = cv::imread(dataset_dir + "/" + std::get<0>(entry), cv::IMREAD_UNCHANGED);
+        cv::Mat depth = cv::imread(dataset_dir + "/" + std::get<1>(entry), cv::IMREAD_UNCHANGED);
+        if (rgb.empty() || depth.empty()) {
+            throw std::runtime_error("[PACKED DATASET]: Failed to read frame " + std::to_string(i));
+        }
+
+        PackedFrame frame;
+        frame.timestamp = std::get<2>(entry);
+        frame.rgb = write_plane(file, rgb, add_string(strings, std::get<0>(entry)));
+        frame.depth = write_plane(file, depth, add_string(strings, std::get<1>(entry)));
+        frames.push_back(frame);
+
+        if ((i + 1) % 100 == 0) {
+            std::cout << "[PACKED DATASET]: Packed " << i + 1 << " of " << dataset.size() << " frames" << std::endl;
+        }
+    }
+
+    // Then the index and string table follow all of the frame data
+    header.index_offset = align_offset(static_cast<uint64_t>(file.tellp()));
+    const char padding[PACKED_ALIGNMENT] = {0};
+    file.write(padding, header.index_offset - static_cast<uint64_t>(file.tellp()));
+    file.write(reinterpret_cast<const char*>(frames.data()), frames.size() * sizeof(PackedFrame));
+
+    header.strings_offset = static_cast<uint64_t>(file.tellp());
+    header.strings_size = strings.size();
+    file.write(strings.data(), strings.size());
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+
+    if (!file) {
+        throw std::runtime_error("[PACKED DATASET]: Failed while writing " + output_path);
+    }
+
+    std::cout << "[PACKED DATASET]: Wrote " << frames.size() << " frames to " << output_path << std::endl;
+}
+
+PackedDataset::PackedDataset(const std::string &filepath) :
+    m_fd{-1},
+    m_data{nullptr},
+    m_size{0}
+{
+    m_fd = open(filepath.c_str(), O_RDONLY);
+    if (m_fd < 0) {
+        throw std::runtime_error("[PACKED DATASET]: Can't open " + filepath);
+    }
+
+    struct stat info;
+    if (fstat(m_fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(PackedHeader)) {
+        close(m_fd);
+        throw std::runtime_error("[PACKED DATASET]: " + filepath + " is too small to be a packed dataset");
+    }
+    m_size = info.st_size;
+
+    // The mapping is private, so any writes to the returned images
+    // are copy-on-write and never reach the file.
+    void* mapping = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, m_fd, 0);
+    if (mapping == MAP_FAILED) {
+        close(m_fd);
+        throw std::runtime_error("[PACKED DATASET]: Failed to map " + filepath);
+    }
+    m_data = static_cast<uint8_t*>(mapping);
+    madvise(m_data, m_size, MADV_SEQUENTIAL);
+
+    m_header = reinterpret_cast<const PackedHeader*>(m_data);
+    if (std::memcmp(m_header->magic, PACKED_MAGIC, sizeof(PACKED_MAGIC)) != 0 || m_header->version != PACKED_VERSION) {
+        unmap();
+        throw std::runtime_error("[PACKED DATASET]: " + filepath + " is not a supported packed dataset");
+    }
+
+    if (m_header->index_offset + m_header->frame_count * sizeof(PackedFrame) > m_size ||
+        m_header->strings_offset + m_header->strings_size > m_size ||
+        m_header->source_dir >= m_header->strings_size) {
+        unmap();
+        throw std::runtime_error("[PACKED DATASET]: " + filepath + " is truncated");
+    }
+
+    m_frames = reinterpret_cast<const PackedFrame*>(m_data + m_header->index_offset);
+    m_strings = reinterpret_cast<const char*>(m_data + m_header->strings_offset);
+
+    for (int i = 0; i < m_header->frame_count; i++) {
+        if (!valid_plane(m_frames[i].rgb) || !valid_plane(m_frames[i].depth)) {
+            unmap();
+            throw std::runtime_error("[PACKED DATASET]: Index of " + filepath + " is corrupted");
+        }
+    }
+
+    std::cout << "[PACKED DATASET]: Mapped " << m_header->frame_count << " frames from " << filepath << std::endl;
+}
+
+PackedDataset::~PackedDataset()
+{
+    unmap();
+}
+
+void PackedDataset::unmap()
+{
+    if (m_data) {
+        munmap(m_data, m_size);
+        m_data = nullptr;
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+int PackedDataset::get_frame_count() const
+{
+    return m_header->frame_count;
+}
+
+OfflineDatasetType PackedDataset::get_dataset_type() const
+{
+    return static_cast<OfflineDatasetType>(m_header->dataset_type);
+}
+
+std::string PackedDataset::get_source_dir() const
+{
+    return std::string(m_strings + m_header->source_dir);
+}
+
+cv::Mat PackedDataset::get_rgb(int index) const
+{
+    return get_plane(m_frames[index].rgb);
+}
+
+cv::Mat PackedDataset::get_depth(int index) const
+{
+    return get_plane(m_frames[index].depth);
+}
+
+double PackedDataset::get_timestamp(int index) const
+{
+    return m_frames[index].timestamp;
+}
+
+std::vector<std::tuple<std::string, std::string, double>> PackedDataset::get_associations() const
+{
+    std::vector<std::tuple<std::string, std::string, double>> ret;
+    for (int i = 0; i < m_header->frame_count; i++) {
+        const PackedFrame &frame = m_frames[i];
+        ret.push_back(std::make_tuple(std::string(m_strings + frame.rgb.name), 
+                                      std::string(m_strings + frame.depth.name), 
+                                      frame.timestamp));
+    }
+
+    return ret;
+}
+
+void PackedDataset::prefetch(int index) const
+{
+    if (index < 0 || index >= m_header->frame_count) {
+        return;
+    }
+
+    // madvise() needs a page aligned address
+    const PackedFrame &frame = m_frames[index];
+    uint64_t start = std::min(frame.rgb.offset, frame.depth.offset);
+    uint64_t end = std::max(frame.rgb.offset + plane_size(frame.rgb.rows, frame.rgb.cols, frame.rgb.type),
+                            frame.depth.offset + plane_size(frame.depth.rows, frame.depth.cols, frame.depth.type));
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    start -= start % page_size;
+    madvise(m_data + start, end - start, MADV_WILLNEED);
+}
+
+cv::Mat PackedDataset::get_plane(const PackedPlane &plane) const
+{
+    return cv::Mat(plane.rows, plane.cols, plane.type, m_data + plane.offset);
+}
+
+bool PackedDataset::valid_plane(const PackedPlane &plane) const
+{
+    return plane.rows > 0 && plane.cols > 0 && plane.name < m_header->strings_size &&
+           plane.offset + plane_size(plane.rows, plane.cols, plane.type) <= m_size;
+}
+
+bool is_packed_dataset(const std::string &filepath)
+{
+    std::ifstream file(filepath, std::ios::binary);
+    char magic[sizeof(PACKED_MAGIC)];
+    if (!file.read(magic, sizeof(magic))) {
+        return false;
+    }
+
+    return std::memcmp(magic, PACKED_MAGIC, sizeof(PACKED_MAGIC)) == 0;
+}
@@ -0,0 +1,198 @@
+#include "util/profile_util.h"
+
+#include <iomanip>
+
+std::atomic<bool> g_profiling_enabled{false};
+
+namespace
+{
+
+// Each thread keeps the last ~32k events, which covers several minutes of frames
+const size_t PROFILE_BUFFER_CAPACITY = 1 << 15;
+
+// Buffers outlive their threads, so the pipeline threads can be joined before writing the trace
+struct ProfileRegistry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ProfileBuffer>> buffers;
+    std::map<int, std::string> track_names;
+    int next_track = 1;
+};
+
+ProfileRegistry& get_registry()
+{
+    static ProfileRegistry registry;
+    return registry;
+}
+
+thread_local ProfileBuffer* t_buffer = nullptr;
+
+ProfileBuffer* get_thread_buffer()
+{
+    if (!t_buffer) {
+        ProfileRegistry &registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        int track = registry.next_track++;
+        registry.buffers.push_back(std::make_unique<ProfileBuffer>(PROFILE_BUFFER_CAPACITY, track));
+        registry.track_names[track] = "Thread " + std::to_string(track);
+        t_buffer = registry.buffers.back().get();
+    }
+    return t_buffer;
+}
+
+std::vector<ProfileEvent> collect_events(uint64_t &dropped)
+{
+    ProfileRegistry &registry = get_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    std::vector<ProfileEvent> events;
+    dropped = 0;
+    for (int i = 0; i < registry.buffers.size(); i++) {
+        std::vector<ProfileEvent> buffer_events = registry.buffers[i]->get_events();
+        events.insert(events.end(), buffer_events.begin(), buffer_events.end());
+        dropped += registry.buffers[i]->get_dropped_count();
+    }
+    return events;
+}
+
+double percentile(const std::vector<int64_t> &sorted, double p)
+{
+    size_t index = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+    return sorted[index] / 1.0e6;
+}
+
+} // namespace
+
+ProfileBuffer::ProfileBuffer(size_t capacity, int track) :
+    m_events(capacity),
+    m_count{0},
+    m_track{track}
+{
+
+}
+
+void ProfileBuffer::record(const ProfileEvent &event)
+{
+    uint64_t count = m_count.load(std::memory_order_relaxed);
+    m_events[count % m_events.size()] = event;
+    m_count.store(count + 1, std::memory_order_release);
+}
+
+std::vector<ProfileEvent> ProfileBuffer::get_events() const
+{
+    uint64_t count = m_count.load(std::memory_order_acquire);
+    uint64_t first = (count > m_events.size()) ? count - m_events.size() : 0;
+
+    std::vector<ProfileEvent> events;
+    events.reserve(count - first);
+    for (uint64_t i = first; i < count; i++) {
+        events.push_back(m_events[i % m_events.size()]);
+    }
+    return events;
+}
+
+uint64_t ProfileBuffer::get_dropped_count() const
+{
+    uint64_t count = m_count.load(std::memory_order_acquire);
+    return (count > m_events.size()) ? count - m_events.size() : 0;
+}
+
+int ProfileBuffer::get_track() const
+{
+    return m_track;
+}
+
+void enable_profiling()
+{
+    g_profiling_enabled.store(true, std::memory_order_relaxed);
+    std::cout << "[PROFILE]: Profiling enabled" << std::endl;
+}
+
+void set_profile_thread_name(const std::string &name)
+{
+    if (!profiling_enabled()) {
+        return;
+    }
+
+    int track = get_thread_buffer()->get_track();
+    ProfileRegistry &registry = get_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.track_names[track] = name;
+}
+
+int add_profile_track(const std::string &name)
+{
+    ProfileRegistry &registry = get_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    int track = registry.next_track++;
+    registry.track_names[track] = name;
+    return track;
+}
+
+void record_profile_event(const char* name, int64_t start_ns, int64_t duration_ns, int track)
+{
+    ProfileBuffer* buffer = get_thread_buffer();
+    buffer->record({name, start_ns, duration_ns, (track < 0) ? buffer->get_track() : track});
+}
+
+bool write_profile_trace(const std::string &filepath)
+{
+    std::ofstream trace(filepath);
+    if (!trace.is_open()) {
+        std::cerr << "[PROFILE]: Can't open trace file " << filepath << std::endl;
+        return false;
+    }
+
+    uint64_t dropped;
+    std::vector<ProfileEvent> events = collect_events(dropped);
+    int64_t origin_ns = events.empty() ? 0 : events.front().start_ns;
+    for (int i = 0; i < events.size(); i++) {
+        origin_ns = std::min(origin_ns, events[i].start_ns);
+    }
+
+    // Complete ("X") events with microsecond timestamps, and a metadata event naming each track.
+    // Timestamps keep their nanoseconds, since events late in a long run are several seconds in.
+    trace << std::fixed << std::setprecision(3);
+    trace << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    {
+        ProfileRegistry &registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (std::map<int, std::string>::const_iterator it = registry.track_names.begin(); it != registry.track_names.end(); it++) {
+            trace << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << it->first
+                  << ",\"args\":{\"name\":\"" << it->second << "\"}},\n";
+        }
+    }
+    for (int i = 0; i < events.size(); i++) {
+        const ProfileEvent &event = events[i];
+        trace << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.track
+              << ",\"ts\":" << (event.start_ns - origin_ns) / 1000.0 << ",\"dur\":" << event.duration_ns / 1000.0 << "}"
+              << ((i + 1 < events.size()) ? ",\n" : "\n");
+    }
+    trace << "]}\n";
+
+    std::cout << "[PROFILE]: Wrote " << events.size() << " events to " << filepath;
+    if (dropped > 0) {
+        std::cout << " (" << dropped << " older events were overwritten)";
+    }
+    std::cout << std::endl;
+    return true;
+}
+
+void print_profile_summary()
+{
+    uint64_t dropped;
+    std::vector<ProfileEvent> events = collect_events(dropped);
+
+    // Events with the same name are summarized together, whichever thread they ran on
+    std::map<std::string, std::vector<int64_t>> durations;
+    for (int i = 0; i < events.size(); i++) {
+        durations[events[i].name].push_back(events[i].duration_ns);
+    }
+
+    for (std::map<std::string, std::vector<int64_t>>::iterator it = durations.begin(); it != durations.end(); it++) {
+        std::vector<int64_t> &sorted = it->second;
+        std::sort(sorted.begin(), sorted.end());
+        std::cout << "[PROFILE]: " << it->first << ": " << sorted.size() << " calls, p50 " << percentile(sorted, 0.50)
+                  << " ms, p95 " << percentile(sorted, 0.95) << " ms, p99 " << percentile(sorted, 0.99) << " ms" << std::endl;
+    }
+}
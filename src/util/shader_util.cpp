@@ -58,6 +58,7 @@ int create_program(const std::string& vertex_path, const std::string& fragment_p
 Shader::Shader(const std::string &vertex_path, const std::string &fragment_path)
 {
     m_id = create_program(vertex_path, fragment_path);
+    cache_uniform_locations();
 }
 
 void Shader::use()
@@ -65,24 +66,74 @@ void Shader::use()
     glUseProgram(m_id);
 }
 
+void Shader::bind_uniform_block(const char* name, GLuint binding) const
+{
+    GLuint index = glGetUniformBlockIndex(m_id, name);
+    if (index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(m_id, index, binding);
+    }
+}
+
+void Shader::cache_uniform_locations()
+{
+    GLint num_uniforms = 0, max_length = 0;
+    glGetProgramiv(m_id, GL_ACTIVE_UNIFORMS, &num_uniforms);
+    glGetProgramiv(m_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+    std::string name(max_length, '\0');
+    for (GLint i = 0; i < num_uniforms; i++) {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type;
+        glGetActiveUniform(m_id, i, max_length, &length, &size, &type, &name[0]);
+
+        // Uniforms in blocks have no location, and are set through their buffer instead
+        GLint location = glGetUniformLocation(m_id, name.c_str());
+        if (location < 0) {
+            continue;
+        }
+
+        // Arrays are reported by their first element, but can be set by their name too
+        std::string uniform_name = name.substr(0, length);
+        add_uniform_location(uniform_name, location);
+        if (uniform_name.size() > 3 && uniform_name.compare(uniform_name.size() - 3, 3, "[0]") == 0) {
+            add_uniform_location(uniform_name.substr(0, uniform_name.size() - 3), location);
+        }
+    }
+}
+
+void Shader::add_uniform_location(const std::string &name, GLint location)
+{
+    std::pair<std::unordered_map<uint32_t, GLint>::iterator, bool> added = m_uniform_locations.emplace(uniform_hash(name.c_str()), location);
+    if (!added.second && added.first->second != location) {
+        std::cerr << "[SHADER]: Uniform " << name << " has the same hash as another uniform" << std::endl;
+    }
+}
+
+GLint Shader::get_uniform_location(UniformName name) const
+{
+    std::unordered_map<uint32_t, GLint>::const_iterator it = m_uniform_locations.find(name.hash);
+    return (it != m_uniform_locations.end()) ? it->second : -1;
+}
+
 // Uniform setters
-void Shader::set_int(const std::string &name, int value) const
+void Shader::set_int(UniformName name, int value) const
 {
-    glUniform1i(glGetUniformLocation(m_id, name.c_str()), value); 
+    glUniform1i(get_uniform_location(name), value); 
 }
 
-void Shader::set_float(const std::string &name, float value) const
+void Shader::set_float(UniformName name, float value) const
 {
-    glUniform1f(glGetUniformLocation(m_id, name.c_str()), value); 
+    glUniform1f(get_uniform_location(name), value); 
 }
 
 
-void Shader::set_vec3(const std::string &name, const glm::vec3 &value) const
+void Shader::set_vec3(UniformName name, const glm::vec3 &value) const
 {
-    glUniform3fv(glGetUniformLocation(m_id, name.c_str()), 1, &value[0]);
+    glUniform3fv(get_uniform_location(name), 1, &value[0]);
 }
 
-void Shader::set_mat4(const std::string &name, const glm::mat4 &value) const
+void Shader::set_mat4(UniformName name, const glm::mat4 &value) const
 {
-    glUniformMatrix4fv(glGetUniformLocation(m_id, name.c_str()), 1, GL_FALSE, &value[0][0]);
+    glUniformMatrix4fv(get_uniform_location(name), 1, GL_FALSE, &value[0][0]);
 }
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include "util/thread_pool.h"
+
+ThreadPool::ThreadPool(int num_threads) :
+    m_stopping{false}
+{
+    for (int i = 0; i < num_threads; i++) {
+        m_workers.push_back(std::thread(&ThreadPool::run_worker, this));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_task_added.notify_all();
+
+    for (int i = 0; i < m_workers.size(); i++) {
+        m_workers[i].join();
+    }
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task)
+{
+    std::packaged_task<void()> packaged(std::move(task));
+    std::future<void> result = packaged.get_future();
+
+    // Without any workers, the task just runs on the calling thread
+    if (m_workers.empty()) {
+        packaged();
+        return result;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push(std::move(packaged));
+    }
+    m_task_added.notify_one();
+
+    return result;
+}
+
+int ThreadPool::get_thread_count() const
+{
+    return m_workers.size();
+}
+
+void ThreadPool::run_worker()
+{
+    set_profile_thread_name("Worker");
+
+    while (true) {
+        std::packaged_task<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_task_added.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+
+            // Remaining tasks are still run before stopping
+            if (m_tasks.empty()) {
+                return;
+            }
+
+            task = std::move(m_tasks.front());
+            m_tasks.pop();
+        }
+
+        task();
+    }
+}